@@ -0,0 +1,125 @@
+// Many solves in flight on one thread (see Unblock-async.h).
+//
+// Reads boards from stdin (in the corpus format of Unblock-generate),
+// starts solving all of them at once on a single SolveLoop, and reports
+// each result as soon as its search is over - so the easy boards come
+// out first, while the hard ones are still being searched:
+//
+//     ZZ.A..B..A..BCCD..E..D..E...FF.GGG.. moves=14 states=5321
+//
+// With a deadline, boards that take longer are reported as "timeout" -
+// and with a budget, those that need more as "out-of-budget".
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "Unblock-async.h"
+
+using namespace std;
+using namespace std::chrono;
+
+void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " [options] < boards.txt\n\n";
+    cerr << "  -k states   pause each search every this many states\n";
+    cerr << "              (default: 1000)\n";
+    cerr << "  -t msec     give up on boards not solved in this time\n";
+    cerr << "              (default: no limit)\n";
+    cerr << "  -n states   give up on each board after examining this\n";
+    cerr << "              many board states\n";
+    cerr << "  -m MB       ...or when its search takes this much memory\n";
+    cerr << "  -M MB       when a search would take more memory than\n";
+    cerr << "              this, go on with IDA* instead\n";
+    exit(1);
+}
+
+struct Totals {
+    size_t _solved = 0, _unsolvable = 0, _outOfBudget = 0, _stopped = 0;
+};
+
+// Awaits the solve of one board, and reports it
+Detached Report(SolveLoop& loop, string board, Puzzle puzzle, State start,
+                Deadline deadline, SolveBudget budget, Totals& totals)
+{
+    SolveResult result = co_await loop.solve(puzzle, start, deadline,
+                                             budget);
+    cout << board;
+    switch (result._status) {
+    case SolveResult::SOLVED:
+        cout << " moves=" << result._path.size() - 1;
+        totals._solved++;
+        break;
+    case SolveResult::UNSOLVABLE:
+        cout << " moves=-1";
+        totals._unsolvable++;
+        break;
+    case SolveResult::OUT_OF_BUDGET:
+        cout << " out-of-budget";
+        totals._outOfBudget++;
+        break;
+    case SolveResult::CANCELLED:
+        cout << " cancelled";
+        totals._stopped++;
+        break;
+    case SolveResult::TIMED_OUT:
+        cout << " timeout";
+        totals._stopped++;
+        break;
+    }
+    cout << " states=" << result._expanded << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    size_t every = 1000;
+    long timeout = 0;
+    SolveBudget budget;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:t:n:m:M:")) != -1) {
+        switch (opt) {
+        case 'k': every = strtoul(optarg, NULL, 10); break;
+        case 't': timeout = atol(optarg); break;
+        case 'n': budget._states = strtoul(optarg, NULL, 10); break;
+        case 'm': budget._bytes = size_t(atof(optarg)*1024*1024); break;
+        case 'M': budget._capBytes = size_t(atof(optarg)*1024*1024); break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    auto begin = steady_clock::now();
+    Deadline deadline = timeout > 0 ?
+        begin + milliseconds(timeout) : Deadline::max();
+    SolveLoop loop(every);
+    Totals totals;
+    string line;
+    size_t boards = 0;
+    while (getline(cin, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        string board = line.substr(0, line.find(' '));
+        Puzzle puzzle;
+        State start;
+        string error;
+        if (!parseBoard(board, puzzle, start, error)) {
+            cerr << board << ": " << error << "\n";
+            continue;
+        }
+        Report(loop, board, puzzle, start, deadline, budget, totals);
+        boards++;
+    }
+    loop.run();
+
+    auto usec = duration_cast<microseconds>(steady_clock::now() - begin);
+    cerr << "# boards=" << boards << " solved=" << totals._solved;
+    cerr << " unsolvable=" << totals._unsolvable;
+    cerr << " out-of-budget=" << totals._outOfBudget;
+    cerr << " stopped=" << totals._stopped;
+    cerr << " steps=" << loop.steps() << " usec=" << usec.count() << "\n";
+    return 0;
+}
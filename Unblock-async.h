@@ -0,0 +1,257 @@
+// Solving many boards at once, from a single thread - with coroutines.
+//
+// SolveBoard runs to completion: a hard board can keep it busy for
+// seconds, and an event-driven server calling it stalls every other
+// request on that thread in the meantime. Here the same search - a
+// BoardSearch (see Unblock-search.h), budget and memory cap included -
+// is driven by a C++20 coroutine, which suspends every 'every' expanded
+// states and at the end of each level. A SolveLoop owns the searches
+// in flight, and resumes each of them in turn - so hundreds of solves
+// are interleaved on the loop's thread.
+//
+// A solve is started with SolveLoop::solve, which returns a Solve: it
+// can be cancelled, and it can be co_await'ed (once) - the awaiting
+// coroutine is resumed (on the loop's thread) with the SolveResult,
+// once the search finds a solution, runs out of states or budget, is
+// cancelled, or misses its deadline.
+//
+// This needs C++20 (g++ -std=c++20); the rest of the engine doesn't.
+
+#ifndef UNBLOCK_ASYNC_H
+#define UNBLOCK_ASYNC_H
+
+#if __cplusplus < 202002L
+#error "Unblock-async.h needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Unblock-engine.h"
+#include "Unblock-search.h"
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+struct SolveResult {
+    enum Status { SOLVED, UNSOLVABLE, OUT_OF_BUDGET, CANCELLED, TIMED_OUT };
+    Status _status = UNSOLVABLE;
+    // When SOLVED, the boards from the starting one to a goal - and when
+    // OUT_OF_BUDGET, the best-known plan (see SolveBoard)
+    std::vector<State> _path;
+    // The board states examined - so far, if the search was stopped
+    size_t _expanded = 0;
+};
+
+// A solve in flight: shared by the loop, its search and the Solve
+// given to the caller
+struct SolveJob {
+    Puzzle _puzzle;
+    State _start = 0;
+    Deadline _deadline = Deadline::max();
+    SolveBudget _budget;
+    bool _cancelled = false, _done = false;
+    SolveResult _result;
+    // Whoever co_await'ed the Solve
+    std::coroutine_handle<> _waiter;
+};
+
+// The coroutine running one search; suspends at its start, and every
+// time it yields
+class SearchTask {
+public:
+    struct promise_type {
+        SearchTask get_return_object() {
+            return SearchTask(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(size_t) noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    SearchTask(SearchTask&& other) noexcept: _handle(other._handle) {
+        other._handle = nullptr;
+    }
+    SearchTask& operator=(SearchTask&& other) noexcept {
+        std::swap(_handle, other._handle);
+        return *this;
+    }
+    ~SearchTask() {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    // Runs the search up to its next pause; returns false once it's over
+    bool resume() {
+        _handle.resume();
+        return !_handle.done();
+    }
+
+private:
+    explicit SearchTask(std::coroutine_handle<promise_type> handle):
+        _handle(handle) {}
+    SearchTask(const SearchTask&) = delete;
+    SearchTask& operator=(const SearchTask&) = delete;
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+// Runs the BoardSearch of a job, 'every' states at a time - the IDA*
+// that takes over past the memory cap too. Before each slice - the
+// first one too - it gives up if the job was cancelled or is past its
+// deadline.
+inline SearchTask Search(std::shared_ptr<SolveJob> job, size_t every)
+{
+    SolveResult& result = job->_result;
+    BoardSearch search(job->_puzzle, job->_start, job->_budget);
+    auto stopped = [&]() {
+        if (job->_cancelled)
+            result._status = SolveResult::CANCELLED;
+        else if (std::chrono::steady_clock::now() > job->_deadline)
+            result._status = SolveResult::TIMED_OUT;
+        else
+            return false;
+        return true;
+    };
+    BoardSearch::Status status;
+    while (true) {
+        if (stopped()) {
+            result._expanded = search.expanded();
+            co_return;
+        }
+        status = search.run(every);
+        if (status != BoardSearch::RUNNING)
+            break;
+        co_yield search.expanded();
+    }
+    if (status == BoardSearch::CAPPED) {
+        status = search.fallBack(stopped, every);
+        while (status == BoardSearch::RUNNING) {
+            co_yield search.expanded();
+            if (stopped()) {
+                result._expanded = search.expanded();
+                co_return;
+            }
+            status = search.fallBack(stopped, every);
+        }
+    }
+    result._expanded = search.expanded();
+    switch (status) {
+    case BoardSearch::SOLVED:
+        result._status = SolveResult::SOLVED;
+        result._path = search.plan();
+        break;
+    case BoardSearch::OUT_OF_BUDGET:
+        result._status = SolveResult::OUT_OF_BUDGET;
+        result._path = search.plan();
+        break;
+    case BoardSearch::STOPPED:
+        break;  // (stopped() set the status)
+    default:
+        result._status = SolveResult::UNSOLVABLE;
+    }
+}
+
+// What SolveLoop::solve gives back: co_await it for the result
+class Solve {
+public:
+    explicit Solve(std::shared_ptr<SolveJob> job): _job(job) {}
+
+    // Stops the search at its next pause; the result is then CANCELLED
+    // (unless the search was over already)
+    void cancel() { _job->_cancelled = true; }
+    bool done() const { return _job->_done; }
+
+    // (A second waiter would take the place of the first - which would
+    // then never be resumed)
+    bool await_ready() const { return _job->_done; }
+    void await_suspend(std::coroutine_handle<> waiter) {
+        assert(!_job->_waiter && "a Solve can only be co_await'ed once");
+        _job->_waiter = waiter;
+    }
+    SolveResult await_resume() { return _job->_result; }
+
+private:
+    std::shared_ptr<SolveJob> _job;
+};
+
+// The searches in flight, all run on the thread calling step() or run()
+class SolveLoop {
+public:
+    // The searches pause every 'every' expanded states
+    explicit SolveLoop(size_t every = 1000): _every(every ? every : 1) {}
+
+    // Starts solving 'start' - it only runs from the next step() on
+    Solve solve(const Puzzle& puzzle, State start,
+                Deadline deadline = Deadline::max(),
+                const SolveBudget& budget = SolveBudget()) {
+        auto job = std::make_shared<SolveJob>();
+        job->_puzzle = puzzle;
+        job->_start = start;
+        job->_deadline = deadline;
+        job->_budget = budget;
+        _starting.push_back(std::make_pair(job, Search(job, _every)));
+        return Solve(job);
+    }
+
+    // Resumes each search in flight once. The coroutines awaiting the
+    // searches that end are resumed right here - and may start more
+    // solves, which join in the next step. Returns false when no
+    // search is left.
+    bool step() {
+        for(auto& s: _starting)
+            _running.push_back(std::move(s));
+        _starting.clear();
+        size_t kept = 0;
+        for(size_t k=0; k<_running.size(); k++) {
+            if (_running[k].second.resume()) {
+                if (kept != k)
+                    std::swap(_running[kept], _running[k]);
+                kept++;
+                continue;
+            }
+            SolveJob& job = *_running[k].first;
+            job._done = true;
+            if (job._waiter)
+                job._waiter.resume();
+        }
+        _running.erase(_running.begin() + kept, _running.end());
+        _slices++;
+        return !_running.empty() || !_starting.empty();
+    }
+
+    // Steps until every search is over
+    void run() {
+        while (step())
+            ;
+    }
+
+    size_t inFlight() const { return _running.size() + _starting.size(); }
+    size_t steps() const { return _slices; }
+
+private:
+    typedef std::pair<std::shared_ptr<SolveJob>, SearchTask> Running;
+    size_t _every, _slices = 0;
+    std::vector<Running> _running, _starting;
+};
+
+// A coroutine nobody waits for - e.g. one that awaits a Solve and
+// reports its result
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+#endif
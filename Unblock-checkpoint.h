@@ -0,0 +1,174 @@
+// Checkpoints: saving a search in progress, to carry on with it later.
+//
+// A batch worker can be preempted in the middle of a long search - and
+// everything the search built in memory goes with it. Instead, SolveBoard
+// can save a snapshot of its BFS every so often, and when it is asked to
+// stop (SIGTERM): the board, the level being searched and how far into
+// it, that level and the next one, and the map from each state seen to
+// the one it was reached from. Resuming from the snapshot carries on
+// right where it was taken.
+//
+// Snapshots are written to a temporary file, which is then renamed over
+// the old one: a worker killed while writing a snapshot still leaves the
+// previous one intact. (Like pattern databases, snapshots are meant for
+// the machine that wrote them: numbers are in native byte order.)
+
+#ifndef UNBLOCK_CHECKPOINT_H
+#define UNBLOCK_CHECKPOINT_H
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Unblock-engine.h"
+
+// Where and how often a search saves its snapshots
+struct SolveCheckpoint {
+    std::string _path;  // none if empty
+    double _seconds;    // time between snapshots
+    bool _resume;       // carry on from the snapshot in _path, if any
+
+    SolveCheckpoint(): _seconds(60), _resume(false) {}
+};
+
+// What's at the start of a snapshot file; the levels and the map follow
+// it, as arrays of States (and pairs of States, for the map).
+struct SnapshotHeader {
+    char _magic[8];                     // "UNBLKSNP"
+    uint32_t _version;
+    char _engine[8];                    // the search that saved it
+    char _board[SIZE*SIZE];             // formatBoard of the whole board
+    int32_t _level;
+    int32_t _bestBlockers;
+    uint64_t _position;                 // states of the level examined
+    uint64_t _expanded;
+    uint64_t _best;
+    double _seconds;
+    uint64_t _frontier, _next, _previous;
+};
+
+// Writes a snapshot to 'path', atomically. On failure, returns false and
+// explains why in 'error' - and the old snapshot, if any, is left as is.
+inline bool saveSnapshot(const std::string& path, SnapshotHeader header,
+                         const std::vector<State>& frontier,
+                         const std::vector<State>& next,
+                         const std::unordered_map<State, State>& previous,
+                         std::string& error)
+{
+    memcpy(header._magic, "UNBLKSNP", 8);
+    header._version = 2;
+    header._frontier = frontier.size();
+    header._next = next.size();
+    header._previous = previous.size();
+
+    std::string temporary = path + ".tmp";
+    FILE *fp = fopen(temporary.c_str(), "wb");
+    if (!fp) {
+        error = "cannot create '" + temporary + "'";
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(frontier.data(), sizeof(State), frontier.size(), fp)
+            == frontier.size() &&
+        fwrite(next.data(), sizeof(State), next.size(), fp) == next.size();
+    // The map goes out a chunk of pairs at a time
+    std::vector<State> chunk;
+    chunk.reserve(8192);
+    for(auto it=previous.begin(); ok && it!=previous.end(); ) {
+        chunk.clear();
+        for(; it!=previous.end() && chunk.size()<8192; ++it) {
+            chunk.push_back(it->first);
+            chunk.push_back(it->second);
+        }
+        ok = fwrite(chunk.data(), sizeof(State), chunk.size(), fp)
+            == chunk.size();
+    }
+    // It must be on disk before it replaces the old snapshot
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        error = "failed to write '" + path + "'";
+        return false;
+    }
+    return true;
+}
+
+// Reads the header of the snapshot in 'fp', and checks that the rest of
+// the file is the size it says
+inline bool readSnapshotHeader(FILE *fp, SnapshotHeader& header)
+{
+    struct stat st;
+    return fstat(fileno(fp), &st) == 0 &&
+        fread(&header, sizeof(header), 1, fp) == 1 &&
+        !memcmp(header._magic, "UNBLKSNP", 8) && header._version == 2 &&
+        uint64_t(st.st_size) == sizeof(header) + sizeof(State)*(
+            header._frontier + header._next + 2*header._previous);
+}
+
+// Reads only the header of the snapshot in 'path' - enough to tell
+// which search it is of. On failure, returns false and explains why in
+// 'error'.
+inline bool peekSnapshot(const std::string& path, SnapshotHeader& header,
+                         std::string& error)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        error = "cannot open '" + path + "'";
+        return false;
+    }
+    bool ok = readSnapshotHeader(fp, header);
+    fclose(fp);
+    if (!ok)
+        error = "'" + path + "' is not a snapshot of a search";
+    return ok;
+}
+
+// Reads back a snapshot written by saveSnapshot. On failure, returns
+// false and explains why in 'error'.
+inline bool loadSnapshot(const std::string& path, SnapshotHeader& header,
+                         std::vector<State>& frontier,
+                         std::vector<State>& next,
+                         std::unordered_map<State, State>& previous,
+                         std::string& error)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        error = "cannot open '" + path + "'";
+        return false;
+    }
+    bool ok = readSnapshotHeader(fp, header);
+    if (ok) {
+        frontier.resize(header._frontier);
+        next.resize(header._next);
+        ok = fread(frontier.data(), sizeof(State), frontier.size(), fp)
+                == frontier.size() &&
+            fread(next.data(), sizeof(State), next.size(), fp)
+                == next.size();
+    }
+    if (ok) {
+        previous.clear();
+        previous.reserve(header._previous);
+        std::vector<State> chunk;
+        for(uint64_t left=header._previous; ok && left; ) {
+            size_t pairs = std::min<uint64_t>(left, 4096);
+            chunk.resize(2*pairs);
+            ok = fread(chunk.data(), sizeof(State), chunk.size(), fp)
+                == chunk.size();
+            for(size_t k=0; ok && k<pairs; k++)
+                previous[chunk[2*k]] = chunk[2*k+1];
+            left -= pairs;
+        }
+    }
+    fclose(fp);
+    if (!ok)
+        error = "'" + path + "' is not a snapshot of a search";
+    return ok;
+}
+
+#endif
@@ -0,0 +1,1792 @@
+// A compact search engine for 6x6 "Unblock Me" boards.
+//
+// The original solver (Unblock-solve.cc) works with lists of Blocks,
+// which is nice for printing - but copying them whole for every state
+// is too slow when we want to solve thousands of boards (e.g. to
+// generate benchmark corpora). This header keeps the same Block model,
+// but splits it in two:
+//
+//  - the static attributes of each block (orientation, length, lane)
+//    which never change during a search, and are kept once in a Puzzle
+//  - the only thing that does change - the coordinate of each block
+//    along its lane - which is packed in a 64-bit State.
+//
+// Each coordinate is at most SIZE-2 = 4, so it fits in 3 bits; and since
+// blocks are at least 2 tiles long, there can be at most 18 of them
+// on the board: 18*3 = 54 bits, so a State fits in a single uint64_t.
+
+#ifndef UNBLOCK_ENGINE_H
+#define UNBLOCK_ENGINE_H
+
+#include <stdint.h>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+
+// The board is SIZE x SIZE tiles
+#define SIZE 6
+
+// Blocks are at least 2 tiles long
+#define MAXBLOCKS (SIZE*SIZE/2)
+
+// A bitmask of board tiles - bit (y*SIZE+x) is tile (y,x)
+typedef uint64_t Cells;
+
+// The packed coordinates of all blocks - 3 bits per block
+typedef uint64_t State;
+
+#define BITS_PER_BLOCK 3
+
+inline Cells tileBit(int y, int x) { return Cells(1) << (y*SIZE + x); }
+
+// The static part of a board: what blocks exist, and how they lie.
+// Kept as a structure-of-arrays, so that the loops over blocks
+// (move generation, occupancy) walk over contiguous memory.
+struct Puzzle {
+    int _count;                     // how many blocks we have
+    int _prisoner;                  // index of the prisoner block
+    bool _isHorizontal[MAXBLOCKS];  // whether the block is Horiz/Vert
+    int _length[MAXBLOCKS];         // how many tiles long it is
+    int _lane[MAXBLOCKS];           // row (horizontal) or column (vertical)
+    int _positions[MAXBLOCKS];      // how many coordinates it can take
+    // The tiles covered by block i when its coordinate is p
+    Cells _masks[MAXBLOCKS][SIZE];
+    // Tiles covered by blocks left out of the search (see reducePuzzle)
+    Cells _fixed;
+
+    Puzzle(): _count(0), _prisoner(-1), _fixed(0) {}
+
+    // Adds a block, and returns its index. 'y' and 'x' are the
+    // top-left tile of the block - just like in Block.
+    int addBlock(int y, int x, bool isHorizontal, int length,
+                 bool isPrisoner, State& state)
+    {
+        int i = _count++;
+        _isHorizontal[i] = isHorizontal;
+        _length[i] = length;
+        _lane[i] = isHorizontal ? y : x;
+        _positions[i] = SIZE - length + 1;
+        for(int p=0; p<SIZE; p++) {
+            _masks[i][p] = 0;
+            if (p >= _positions[i])
+                continue;
+            for(int j=0; j<length; j++)
+                _masks[i][p] |= isHorizontal ?
+                    tileBit(y, p+j) : tileBit(p+j, x);
+        }
+        if (isPrisoner)
+            _prisoner = i;
+        state = set(state, i, isHorizontal ? x : y);
+        return i;
+    }
+
+    static int get(State s, int i) {
+        return int(s >> (BITS_PER_BLOCK*i)) & 7;
+    }
+    static State set(State s, int i, int pos) {
+        int shift = BITS_PER_BLOCK*i;
+        return (s & ~(State(7) << shift)) | (State(pos) << shift);
+    }
+
+    // The top-left tile of block i in state s
+    int y(State s, int i) const {
+        return _isHorizontal[i] ? _lane[i] : get(s, i);
+    }
+    int x(State s, int i) const {
+        return _isHorizontal[i] ? get(s, i) : _lane[i];
+    }
+
+    Cells occupancy(State s) const {
+        Cells occupied = _fixed;
+        for(int i=0; i<_count; i++)
+            occupied |= _masks[i][get(s, i)];
+        return occupied;
+    }
+
+    // Checks that no blocks overlap and that all are inside the board
+    bool isLegal(State s) const {
+        Cells occupied = _fixed;
+        for(int i=0; i<_count; i++) {
+            int p = get(s, i);
+            if (p >= _positions[i] || (occupied & _masks[i][p]))
+                return false;
+            occupied |= _masks[i][p];
+        }
+        return true;
+    }
+
+    // Same check as SolveBoard: can the prisoner escape to his right?
+    bool isGoal(State s, Cells occupied) const {
+        int p = get(s, _prisoner);
+        int lane = _lane[_prisoner];
+        for(int x=p+_length[_prisoner]; x<SIZE; x++)
+            if (occupied & tileBit(lane, x))
+                return false;
+        return true;
+    }
+    bool isGoal(State s) const { return isGoal(s, occupancy(s)); }
+
+    // How many tiles still block the prisoner's way out (0 for a goal)
+    int exitBlockers(State s, Cells occupied) const {
+        int p = get(s, _prisoner);
+        int lane = _lane[_prisoner], blockers = 0;
+        for(int x=p+_length[_prisoner]; x<SIZE; x++)
+            blockers += (occupied & tileBit(lane, x)) != 0;
+        return blockers;
+    }
+
+    // Calls f(nextState, block, delta) for every legal slide from 's'.
+    // A slide of any distance counts as one move - like in SolveBoard.
+    template <class F>
+    void forEachMove(State s, Cells occupied, F f) const {
+        for(int i=0; i<_count; i++) {
+            int p = get(s, i);
+            Cells others = occupied & ~_masks[i][p];
+            for(int np=p-1; np>=0 && !(others & _masks[i][np]); np--)
+                f(set(s, i, np), i, np-p);
+            for(int np=p+1; np<_positions[i] &&
+                    !(others & _masks[i][np]); np++)
+                f(set(s, i, np), i, np-p);
+        }
+    }
+    template <class F>
+    void forEachMove(State s, F f) const { forEachMove(s, occupancy(s), f); }
+};
+
+// The textual form of a board, used for corpora: 36 characters, row
+// by row, with '.' for empty tiles, 'Z' for the prisoner (as in
+// printBoard) and 'A', 'B', ... for the other blocks.
+inline std::string formatBoard(const Puzzle& puzzle, State s)
+{
+    std::string out(SIZE*SIZE, '.');
+    char letter = 'A';
+    for(int i=0; i<puzzle._count; i++) {
+        char c = (i == puzzle._prisoner) ? 'Z' : letter++;
+        Cells mask = puzzle._masks[i][Puzzle::get(s, i)];
+        for(int t=0; t<SIZE*SIZE; t++)
+            if (mask & (Cells(1) << t))
+                out[t] = c;
+    }
+    return out;
+}
+
+// The reverse of formatBoard. Returns false (with a reason in 'error')
+// if the text is not a board with straight blocks and one prisoner.
+inline bool parseBoard(const std::string& text, Puzzle& puzzle, State& s,
+                       std::string& error)
+{
+    puzzle = Puzzle();
+    s = 0;
+    if (text.size() != SIZE*SIZE) {
+        error = "a board must have exactly 36 tiles";
+        return false;
+    }
+    bool seen[256];
+    memset(seen, false, sizeof(seen));
+    int tilesUsed = 0;
+    for(int t=0; t<SIZE*SIZE; t++) {
+        unsigned char c = text[t];
+        if (c == '.' || seen[c])
+            continue;
+        seen[c] = true;
+        if (!isalpha(c)) {
+            error = std::string("unexpected character '") + char(c) + "'";
+            return false;
+        }
+        // The first time we meet a letter is its top-left tile
+        int y = t/SIZE, x = t%SIZE;
+        int h = 1, v = 1;
+        while(x+h<SIZE && text[t+h] == char(c)) h++;
+        while(y+v<SIZE && text[t+v*SIZE] == char(c)) v++;
+        if ((h>1) == (v>1)) {
+            error = std::string("block '") + char(c) + "' is not a line";
+            return false;
+        }
+        bool isPrisoner = (c == 'Z');
+        if (isPrisoner && v>1) {
+            error = "the prisoner must be horizontal";
+            return false;
+        }
+        if (puzzle._count == MAXBLOCKS) {
+            error = "too many blocks";
+            return false;
+        }
+        puzzle.addBlock(y, x, h>1, h>1 ? h : v, isPrisoner, s);
+        tilesUsed += h>1 ? h : v;
+    }
+    if (puzzle._prisoner < 0) {
+        error = "no prisoner ('Z') on the board";
+        return false;
+    }
+    // Count the tiles back - stray letters mean a malformed block
+    int tilesSet = 0;
+    for(int t=0; t<SIZE*SIZE; t++)
+        tilesSet += text[t] != '.';
+    if (tilesSet != tilesUsed) {
+        error = "blocks are not contiguous, or a letter is used twice";
+        return false;
+    }
+    return true;
+}
+
+// Limits on the resources of a single solve - so that one pathological
+// board can't keep a worker busy forever. Zero means no limit.
+struct SolveBudget {
+    double _seconds;    // wall time
+    size_t _states;     // board states examined
+    size_t _bytes;      // memory taken by the search's own structures
+    // Unlike the others, not a limit to give up at: when a BFS would
+    // need more memory than this, it goes on with IDA* instead
+    size_t _capBytes;
+
+    SolveBudget(): _seconds(0), _states(0), _bytes(0), _capBytes(0) {}
+};
+
+// What a solve went through - even if it gave up
+struct SolveStats {
+    size_t _expanded;   // board states examined
+    size_t _stored;     // board states seen (examined or queued)
+    size_t _bytes;      // memory taken by the search's own structures
+    int _depth;         // the deepest level searched
+    double _seconds;
+    bool _outOfBudget;  // whether it stopped before the search was over
+    bool _fellBack;     // whether it went on with IDA* (see _capBytes)
+
+    SolveStats():
+        _expanded(0), _stored(0), _bytes(0), _depth(0), _seconds(0),
+        _outOfBudget(false), _fellBack(false) {}
+};
+
+// What we can tell about the blocks of a board before searching.
+//
+// Some blocks can never move: those whose two ends (the tiles right
+// before and after them, along their lane) are off the board, or
+// covered by blocks that can't move either - they hold each other in
+// place. We find the largest such set - a greatest fixpoint: we start
+// with all the blocks, and drop those with a free end until none is
+// left to drop.
+//
+// And many blocks never *need* to move. The prisoner's row must be
+// cleared, so the blocks that can reach it matter; to move out of the
+// way, they may need any tile they can reach - so the blocks that can
+// reach *those* matter too, and so on. That's a walk over the graph of
+// "may block" edges, from the prisoner. A block it doesn't get to never
+// shares a tile with the blocks that matter, so moving it never helps.
+struct BlockAnalysis {
+    bool _immobile[MAXBLOCKS];
+    bool _relevant[MAXBLOCKS];
+    Cells _reach[MAXBLOCKS];    // the tiles each block can ever cover
+
+    BlockAnalysis(const Puzzle& puzzle, State s) {
+        int n = puzzle._count;
+        auto cellsOf = [&](int i) {
+            return puzzle._masks[i][Puzzle::get(s, i)];
+        };
+        // The tile past each end of block i at p, or 0 if off the board
+        auto end = [&](int i, int p, int side) {
+            int np = p + side;
+            if (np < 0 || np >= puzzle._positions[i])
+                return Cells(0);
+            return puzzle._masks[i][np] & ~puzzle._masks[i][p];
+        };
+
+        Cells walls = 0;
+        for(int i=0; i<n; i++) {
+            _immobile[i] = true;
+            walls |= cellsOf(i);
+        }
+        for(bool changed=true; changed; ) {
+            changed = false;
+            for(int i=0; i<n; i++) {
+                if (!_immobile[i])
+                    continue;
+                int p = Puzzle::get(s, i);
+                Cells before = end(i, p, -1), after = end(i, p, 1);
+                if ((before && !(before & walls)) ||
+                        (after && !(after & walls))) {
+                    _immobile[i] = false;
+                    walls &= ~cellsOf(i);
+                    changed = true;
+                }
+            }
+        }
+
+        // Only the immobile blocks stop others for good
+        for(int i=0; i<n; i++) {
+            int p = Puzzle::get(s, i);
+            _reach[i] = cellsOf(i);
+            if (_immobile[i])
+                continue;
+            Cells others = walls & ~cellsOf(i);
+            for(int np=p-1; np>=0 && !(others & puzzle._masks[i][np]); np--)
+                _reach[i] |= puzzle._masks[i][np];
+            for(int np=p+1; np<puzzle._positions[i] &&
+                    !(others & puzzle._masks[i][np]); np++)
+                _reach[i] |= puzzle._masks[i][np];
+        }
+
+        // The prisoner's way out, and whatever the relevant blocks reach
+        int prisoner = puzzle._prisoner;
+        Cells needed = _reach[prisoner];
+        int lane = puzzle._lane[prisoner];
+        for(int x=Puzzle::get(s, prisoner); x<SIZE; x++)
+            needed |= tileBit(lane, x);
+        for(int i=0; i<n; i++)
+            _relevant[i] = i == prisoner;
+        for(bool changed=true; changed; ) {
+            changed = false;
+            for(int i=0; i<n; i++)
+                if (!_relevant[i] && !_immobile[i] && (_reach[i] & needed)) {
+                    _relevant[i] = true;
+                    needed |= _reach[i];
+                    changed = true;
+                }
+        }
+    }
+};
+
+// The puzzle of the prisoner and the relevant blocks alone: the others
+// stay where they are in 's', and are folded into _fixed - so they cost
+// nothing in move generation, and the states get smaller. Sets
+// 'reduced' to the state of the new puzzle, and 'kept' to the index in
+// 'puzzle' of each of its blocks.
+inline Puzzle reducePuzzle(const Puzzle& puzzle, State s,
+                           const BlockAnalysis& analysis, State& reduced,
+                           std::vector<int>& kept)
+{
+    Puzzle result;
+    result._fixed = puzzle._fixed;
+    reduced = 0;
+    kept.clear();
+    for(int i=0; i<puzzle._count; i++) {
+        if (!analysis._relevant[i]) {
+            result._fixed |= puzzle._masks[i][Puzzle::get(s, i)];
+            continue;
+        }
+        result.addBlock(puzzle.y(s, i), puzzle.x(s, i),
+                        puzzle._isHorizontal[i], puzzle._length[i],
+                        i == puzzle._prisoner, reduced);
+        kept.push_back(i);
+    }
+    return result;
+}
+
+// The state of the whole puzzle: 'full', with the blocks kept by
+// reducePuzzle moved to where 'reduced' has them
+inline State expandState(State full, State reduced,
+                         const std::vector<int>& kept)
+{
+    for(size_t k=0; k<kept.size(); k++)
+        full = Puzzle::set(full, kept[k], Puzzle::get(reduced, int(k)));
+    return full;
+}
+
+// Breadth-first search over packed states - the same search as
+// SolveBoard, minus the bookkeeping needed to print the solution.
+//
+// Returns the optimal number of moves, or -1 if there is no solution.
+// If 'expanded' is given, it is set to the number of states examined.
+inline int SolveDepth(const Puzzle& puzzle, State start,
+                      size_t *expanded = NULL)
+{
+    std::unordered_set<State> visited;
+    std::vector<State> frontier, next;
+    visited.insert(start);
+    frontier.push_back(start);
+    size_t examined = 0;
+    for(int depth=0; !frontier.empty(); depth++) {
+        next.clear();
+        for(size_t k=0; k<frontier.size(); k++) {
+            State s = frontier[k];
+            Cells occupied = puzzle.occupancy(s);
+            examined++;
+            if (puzzle.isGoal(s, occupied)) {
+                if (expanded) *expanded = examined;
+                return depth;
+            }
+            puzzle.forEachMove(s, occupied,
+                [&](State n, int, int) {
+                    if (visited.insert(n).second)
+                        next.push_back(n);
+                });
+        }
+        frontier.swap(next);
+    }
+    if (expanded) *expanded = examined;
+    return -1;
+}
+
+// States have few bits set, in similar places: this mixes them well
+// (it's the finalizer of splitmix64), for hash tables of our own
+inline uint64_t hashState(State s)
+{
+    s = (s ^ (s >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    s = (s ^ (s >> 27)) * 0x94d049bb133111ebULL;
+    return s ^ (s >> 31);
+}
+
+// Perfect ranking: numbering the states reachable from a starting
+// board as 0, 1, 2..., so that a visited set can be a plain bit vector.
+//
+// Blocks on the same lane (row, for horizontal blocks; column, for
+// vertical ones) can never overlap or pass each other. So for each lane
+// we list the placements of its blocks that keep them apart and in
+// their starting order, and number them. The placement numbers of all
+// horizontal lanes make up a mixed-radix number - the horizontal
+// configuration - and likewise for the vertical lanes.
+//
+// Not every pair of configurations is a legal board, though: horizontal
+// and vertical blocks may collide. So for each configuration of one
+// orientation (the "outer" one) we keep the sorted list of the
+// configurations of the other orientation that fit with it; a state's
+// rank is the position of its pair in these lists, one after the other.
+// That makes the ranks dense - as many as there are legal boards, a few
+// hundred thousand at most - at the cost of a binary search in a short
+// list per rank. (The orientation with more configurations is the outer
+// one, since that makes the lists shorter.)
+//
+// With 'maxRanks', the ranker gives up as soon as there are more ranks
+// than that - leaving none, as if the block set was too big.
+class StateRanker {
+public:
+    StateRanker(const Puzzle& puzzle, State start, uint64_t maxRanks = 0):
+        _maxRanks(maxRanks)
+    {
+        for(int i=0; i<puzzle._count; i++) {
+            size_t l = 0;
+            while (l < _lanes.size() &&
+                    (puzzle._isHorizontal[_lanes[l]._blocks[0]] !=
+                         puzzle._isHorizontal[i] ||
+                     puzzle._lane[_lanes[l]._blocks[0]] != puzzle._lane[i]))
+                l++;
+            if (l == _lanes.size())
+                _lanes.push_back(Lane());
+            _lanes[l]._blocks.push_back(i);
+        }
+        uint64_t counts[2] = { 1, 1 };  // vertical, horizontal
+        for(size_t l=0; l<_lanes.size(); l++) {
+            Lane& lane = _lanes[l];
+            std::sort(lane._blocks.begin(), lane._blocks.end(),
+                [&](int a, int b) {
+                    return Puzzle::get(start, a) < Puzzle::get(start, b);
+                });
+            lane._index.assign(size_t(1) << (3*lane._blocks.size()), -1);
+            addPlacements(puzzle, lane, 0, 0, 0, 0, 0);
+            counts[puzzle._isHorizontal[lane._blocks[0]]] *=
+                lane._placements.size();
+        }
+        bool outerIsHorizontal = counts[1] >= counts[0];
+        _firstInner = std::stable_partition(_lanes.begin(), _lanes.end(),
+            [&](const Lane& lane) {
+                return puzzle._isHorizontal[lane._blocks[0]] ==
+                    outerIsHorizontal;
+            }) - _lanes.begin();
+        uint64_t outerCount = counts[outerIsHorizontal];
+        uint64_t innerCount = counts[!outerIsHorizontal];
+
+        // Each lane's digit of its configuration, by its coordinates -
+        // already multiplied by the digit's weight (the first lane is
+        // the most significant)
+        uint64_t weights[2] = { 1, 1 };  // outer, inner
+        for(size_t l=_lanes.size(); l-- > 0; ) {
+            Lane& lane = _lanes[l];
+            uint64_t& weight = weights[l >= _firstInner];
+            lane._weight = weight;
+            lane._digit.assign(lane._index.size(), 0);
+            for(size_t key=0; key<lane._index.size(); key++)
+                if (lane._index[key] >= 0)
+                    lane._digit[key] = lane._index[key] * weight;
+            weight *= lane._placements.size();
+        }
+
+        // ...and all that rank() needs, in one flat array
+        _laneCount = int(_lanes.size());
+        for(int l=0; l<_laneCount; l++) {
+            LaneDigits& digits = _digits[l];
+            digits._blocks = int(_lanes[l]._blocks.size());
+            for(int j=0; j<digits._blocks; j++)
+                digits._shifts[j] = BITS_PER_BLOCK*_lanes[l]._blocks[j];
+            digits._isInner = size_t(l) >= _firstInner;
+            digits._digit = &_lanes[l]._digit[0];
+        }
+
+        // (with at most 18 blocks, neither count can overflow - but
+        // the offsets below must stay of a sane size, and within the
+        // limit)
+        if (outerCount > (1u << 24) || innerCount > (1u << 31) ||
+                (_maxRanks && outerCount > _maxRanks)) {
+            _offsets.assign(1, 0);
+            return;
+        }
+        _offsets.reserve(outerCount + 1);
+        addConfigurations(0, 0, 0, 0);
+        if (_maxRanks && _inner.size() > _maxRanks) {
+            std::vector<uint32_t>().swap(_inner);
+            _offsets.assign(1, 0);
+            return;
+        }
+        _offsets.push_back(uint32_t(_inner.size()));
+    }
+
+    // How many ranks there are - or 0 if the block set is too big to
+    // be ranked this way
+    uint64_t size() const { return _offsets.back(); }
+
+    // What the ranker's tables take - mostly 4 bytes per rank
+    size_t bytes() const {
+        size_t total = (_offsets.capacity() + _inner.capacity()) *
+            sizeof(uint32_t);
+        for(auto& lane: _lanes)
+            total += lane._index.capacity()*sizeof(int) +
+                lane._digit.capacity()*sizeof(uint64_t) +
+                lane._placements.capacity()*(sizeof(State) + sizeof(Cells));
+        return total;
+    }
+
+    uint64_t rank(State s) const {
+        uint64_t digits[2] = { 0, 0 };  // outer, inner
+        for(int l=0; l<_laneCount; l++) {
+            const LaneDigits& lane = _digits[l];
+            unsigned key = 0;
+            for(int j=0; j<lane._blocks; j++)
+                key |= unsigned(s >> lane._shifts[j] & 7) << (3*j);
+            digits[lane._isInner] += lane._digit[key];
+        }
+        uint64_t outer = digits[0], inner = digits[1];
+        std::vector<uint32_t>::const_iterator
+            first = _inner.begin() + _offsets[outer],
+            last = _inner.begin() + _offsets[outer+1];
+        return std::lower_bound(first, last, uint32_t(inner)) -
+            _inner.begin();
+    }
+
+    State unrank(uint64_t r) const {
+        uint64_t outer = std::upper_bound(_offsets.begin(), _offsets.end(),
+                                          uint32_t(r)) - _offsets.begin() - 1;
+        uint64_t inner = _inner[r];
+        State s = 0;
+        for(size_t l=0; l<_lanes.size(); l++) {
+            const Lane& lane = _lanes[l];
+            uint64_t c = l >= _firstInner ? inner : outer;
+            s |= lane._placements[c / lane._weight %
+                                  lane._placements.size()];
+        }
+        return s;
+    }
+
+private:
+    // (rank() points into _lanes)
+    StateRanker(const StateRanker&);
+    StateRanker& operator=(const StateRanker&);
+
+    struct Lane {
+        std::vector<int> _blocks;        // in their order along the lane
+        std::vector<State> _placements;  // their bits of the State...
+        std::vector<Cells> _occupied;    // ...and the tiles they cover
+        std::vector<int> _index;         // by their packed coordinates
+        std::vector<uint64_t> _digit;    // (see the constructor)
+        uint64_t _weight;
+    };
+
+    static void addPlacements(const Puzzle& puzzle, Lane& lane, size_t j,
+                              int from, State bits, Cells occupied,
+                              unsigned key)
+    {
+        if (j == lane._blocks.size()) {
+            lane._index[key] = int(lane._placements.size());
+            lane._placements.push_back(bits);
+            lane._occupied.push_back(occupied);
+            return;
+        }
+        int i = lane._blocks[j];
+        for(int p=from; p<puzzle._positions[i]; p++)
+            addPlacements(puzzle, lane, j+1, p + puzzle._length[i],
+                          Puzzle::set(bits, i, p),
+                          occupied | puzzle._masks[i][p],
+                          key | (p << (3*j)));
+    }
+
+    // Lists the configurations of lanes l and on, in rank order
+    void addConfigurations(size_t l, uint64_t outer, uint64_t inner,
+                           Cells occupied)
+    {
+        if (_maxRanks && _inner.size() > _maxRanks)
+            return;
+        // (the outer configurations come in order, each once)
+        if (l == _firstInner)
+            _offsets.push_back(uint32_t(_inner.size()));
+        if (l == _lanes.size()) {
+            _inner.push_back(uint32_t(inner));
+            return;
+        }
+        const Lane& lane = _lanes[l];
+        for(size_t k=0; k<lane._placements.size(); k++)
+            if (!(occupied & lane._occupied[k])) {
+                if (l < _firstInner)
+                    addConfigurations(l+1, outer + k*lane._weight, inner,
+                                      occupied | lane._occupied[k]);
+                else
+                    addConfigurations(l+1, outer, inner + k*lane._weight,
+                                      occupied | lane._occupied[k]);
+            }
+    }
+
+    // At most 3 blocks fit on a lane
+    struct LaneDigits {
+        int _blocks, _shifts[3];
+        bool _isInner;
+        const uint64_t *_digit;
+    };
+
+    std::vector<Lane> _lanes;
+    size_t _firstInner;
+    LaneDigits _digits[2*SIZE];
+    int _laneCount;
+    // The inner configurations that fit with outer configuration c
+    // are _inner[_offsets[c] .. _offsets[c+1]-1]
+    std::vector<uint32_t> _offsets, _inner;
+    uint64_t _maxRanks;
+};
+
+// One bit per rank: the visited set, when we only need the depth
+class RankBits {
+public:
+    explicit RankBits(uint64_t size): _words((size + 63)/64, 0) {}
+    // Marks rank r, and returns whether it was already marked
+    bool testAndSet(uint64_t r) {
+        uint64_t& word = _words[r >> 6];
+        uint64_t bit = uint64_t(1) << (r & 63);
+        bool was = (word & bit) != 0;
+        word |= bit;
+        return was;
+    }
+private:
+    std::vector<uint64_t> _words;
+};
+
+// Two bits per rank: the BFS depth of each state, modulo 3 - plus one,
+// since 0 means not reached yet. That's enough to walk back from the
+// goal: the neighbours of a state at depth d are at depth d-1, d or
+// d+1 - three different values modulo 3 - so the one at d-1 can be told
+// apart.
+class RankLayers {
+public:
+    enum { UNSEEN = 0 };
+    explicit RankLayers(uint64_t size): _words((size + 31)/32, 0) {}
+    static int layer(int depth) { return depth%3 + 1; }
+    int get(uint64_t r) const {
+        return int(_words[r >> 5] >> (2*(r & 31))) & 3;
+    }
+    void set(uint64_t r, int layer) {
+        _words[r >> 5] |= uint64_t(layer) << (2*(r & 31));
+    }
+private:
+    std::vector<uint64_t> _words;
+};
+
+// SolveDepth, with a bit per rank as its visited set
+inline int SolveDepthRanked(const Puzzle& puzzle, State start,
+                            size_t *expanded = NULL)
+{
+    StateRanker ranker(puzzle, start);
+    RankBits visited(ranker.size());
+    std::vector<State> frontier(1, start), next;
+    visited.testAndSet(ranker.rank(start));
+    size_t examined = 0;
+    for(int depth=0; !frontier.empty(); depth++) {
+        next.clear();
+        for(size_t k=0; k<frontier.size(); k++) {
+            State s = frontier[k];
+            Cells occupied = puzzle.occupancy(s);
+            examined++;
+            if (puzzle.isGoal(s, occupied)) {
+                if (expanded) *expanded = examined;
+                return depth;
+            }
+            puzzle.forEachMove(s, occupied,
+                [&](State n, int, int) {
+                    if (!visited.testAndSet(ranker.rank(n)))
+                        next.push_back(n);
+                });
+        }
+        frontier.swap(next);
+    }
+    if (expanded) *expanded = examined;
+    return -1;
+}
+
+// The same search, keeping the depth of each state in a RankLayers -
+// so it can also return the boards of the solution, from 'start' to the
+// goal, in 'path'. Returns false if there is no solution.
+inline bool SolvePathRanked(const Puzzle& puzzle, State start,
+                            std::vector<State>& path,
+                            size_t *expanded = NULL)
+{
+    StateRanker ranker(puzzle, start);
+    RankLayers layers(ranker.size());
+    std::vector<State> frontier(1, start), next;
+    layers.set(ranker.rank(start), RankLayers::layer(0));
+    size_t examined = 0;
+    for(int depth=0; !frontier.empty(); depth++) {
+        next.clear();
+        for(size_t k=0; k<frontier.size(); k++) {
+            State s = frontier[k];
+            Cells occupied = puzzle.occupancy(s);
+            examined++;
+            if (puzzle.isGoal(s, occupied)) {
+                if (expanded) *expanded = examined;
+                // Walk back, each time to a neighbour one level up
+                path.assign(depth+1, s);
+                for(int d=depth-1; d>=0; d--)
+                    puzzle.forEachMove(path[d+1],
+                        [&](State n, int, int) {
+                            if (layers.get(ranker.rank(n)) == RankLayers::layer(d))
+                                path[d] = n;
+                        });
+                return true;
+            }
+            puzzle.forEachMove(s, occupied,
+                [&](State n, int, int) {
+                    uint64_t r = ranker.rank(n);
+                    if (layers.get(r) == RankLayers::UNSEEN) {
+                        layers.set(r, RankLayers::layer(depth+1));
+                        next.push_back(n);
+                    }
+                });
+        }
+        frontier.swap(next);
+    }
+    if (expanded) *expanded = examined;
+    return false;
+}
+
+// How much a move costs, when moves aren't all equal: a fixed cost per
+// slide, plus a cost per tile the block travels. The default - one per
+// tile - finds the plans that move blocks the least; adding a slide
+// cost trades distance for fewer moves.
+struct MoveCost {
+    int _slide, _tile;
+
+    MoveCost(int slide = 0, int tile = 1): _slide(slide), _tile(tile) {}
+    int operator()(int delta) const {
+        return _slide + _tile*(delta < 0 ? -delta : delta);
+    }
+    // The most a single move can cost
+    int maximum() const { return (*this)(SIZE-2); }
+};
+
+// Dijkstra's search for the cheapest solution under 'cost' (whose costs
+// must be positive), over the same packed states and ranks as
+// SolvePathRanked. Move costs are small integers, so instead of a heap
+// the queue is an array of buckets - one per cost - used as a ring:
+// only the costs from the current one to the current one plus the
+// biggest move cost can be pending at any time.
+//
+// Each rank keeps the best cost found for its state; states can be
+// queued more than once, and the stale entries are skipped when popped.
+// Returns the cost of the cheapest solution (-1 if there is none), and
+// if 'path' is given, fills it with the boards from 'start' to the goal.
+inline int SolveWeighted(const Puzzle& puzzle, State start,
+                         const MoveCost& cost,
+                         std::vector<State> *path = NULL,
+                         size_t *expanded = NULL)
+{
+    const uint32_t UNREACHED = UINT32_MAX;
+    StateRanker ranker(puzzle, start);
+    std::vector<uint32_t> best(ranker.size(), UNREACHED);
+    std::vector<std::vector<State> > buckets(cost.maximum() + 1);
+    best[ranker.rank(start)] = 0;
+    buckets[0].push_back(start);
+    size_t examined = 0, pending = 1;
+    int result = -1;
+    State goal = start;
+    for(uint32_t c=0; pending && result < 0; c++) {
+        std::vector<State>& bucket = buckets[c % buckets.size()];
+        // (moves into this same bucket are impossible: costs are positive)
+        for(size_t k=0; k<bucket.size(); k++) {
+            State s = bucket[k];
+            if (best[ranker.rank(s)] != c)
+                continue;
+            Cells occupied = puzzle.occupancy(s);
+            examined++;
+            if (puzzle.isGoal(s, occupied)) {
+                result = int(c);
+                goal = s;
+                break;
+            }
+            puzzle.forEachMove(s, occupied,
+                [&](State n, int, int delta) {
+                    uint32_t nc = c + cost(delta);
+                    uint32_t& b = best[ranker.rank(n)];
+                    if (nc < b) {
+                        b = nc;
+                        buckets[nc % buckets.size()].push_back(n);
+                        pending++;
+                    }
+                });
+        }
+        pending -= bucket.size();
+        bucket.clear();
+    }
+    if (expanded) *expanded = examined;
+    if (result >= 0 && path) {
+        // Walk back, each time to a neighbour whose cost plus that of
+        // the move gives ours
+        path->assign(1, goal);
+        for(State s=goal; s!=start; ) {
+            uint32_t c = best[ranker.rank(s)];
+            State from = s;
+            puzzle.forEachMove(s, [&](State n, int, int delta) {
+                uint32_t b = best[ranker.rank(n)];
+                if (b != UNREACHED && b + cost(delta) == c)
+                    from = n;
+            });
+            s = from;
+            path->push_back(s);
+        }
+        std::reverse(path->begin(), path->end());
+    }
+    return result;
+}
+
+// A lower bound on the moves left: each block in the prisoner's way
+// has to move at least once.
+inline int exitLaneBlocks(const Puzzle& puzzle, State s)
+{
+    int p = Puzzle::get(s, puzzle._prisoner);
+    int lane = puzzle._lane[puzzle._prisoner];
+    Cells exit = 0;
+    for(int x=p+puzzle._length[puzzle._prisoner]; x<SIZE; x++)
+        exit |= tileBit(lane, x);
+    int blocks = 0;
+    for(int i=0; i<puzzle._count; i++)
+        blocks += (puzzle._masks[i][Puzzle::get(s, i)] & exit) != 0;
+    return blocks;
+}
+
+// IDA*: depth-first searches with a growing bound on the number of moves
+// (plus the estimate of exitLaneBlocks) - in next to no memory, but
+// with no visited set, so the same boards are reached over and over.
+//
+// Much of that is the same moves in another order: sliding two blocks
+// whose paths don't cross gives the same board either way. With
+// 'reduce', the search only tries such independent moves in one order -
+// the lower block index first. That is, a move is skipped if the move
+// before it was of a higher block, and the tiles the two blocks swept
+// don't overlap (then the other order is legal too, and is searched).
+// Any path can be reordered that way without getting longer, so the
+// optimal depth is still found. Moving the same block twice in a row is
+// never needed either, since a single slide does the same.
+//
+// Without 'reduce', only the move undoing the previous one is skipped.
+// Returns the optimal number of moves (-1 if there is no solution), and
+// if 'path' is given, fills it with the boards from 'start' to the goal.
+//
+// A better 'estimate' than exitLaneBlocks can be given - e.g. from a
+// pattern database. It must never overestimate, and return -1 for the
+// boards it knows to have no solution.
+//
+// With a transposition table (see useTable), most boards reached twice
+// in an iteration are only searched once - in a fixed amount of memory.
+// It also tells when there is nothing left to find: a board cut off by
+// the bound only raises the next one if no iteration expanded it in as
+// few moves yet. (Expanded in fewer, whatever lies past it is searched
+// from there.) The cycles of an unsolvable board keep cutting off the
+// boards it already went through, at ever more moves - once those are
+// all that is left, the board has no solution. Without a table, or if
+// it's too small to hold them, that can't be told - and the search of
+// an unsolvable board only ends when it's stopped.
+class IDAStar {
+public:
+    typedef std::function<int(State)> Estimate;
+    // Called every 1024 boards expanded; the search stops if it returns
+    // true (see resume)
+    typedef std::function<bool(size_t expanded)> Stop;
+
+    IDAStar(const Puzzle& puzzle, bool reduce,
+            Estimate estimate = Estimate()):
+        _puzzle(puzzle), _reduce(reduce), _expanded(0), _estimate(estimate),
+        _stopped(false), _start(0), _bound(-1), _nextBound(0),
+        _iteration(0)
+    {
+        if (!_estimate)
+            _estimate = [&puzzle](State s) {
+                return exitLaneBlocks(puzzle, s);
+            };
+    }
+
+    // Keeps a table of boards in (at most) 'bytes' of memory, each with
+    // the fewest moves it was reached in during this iteration: reaching
+    // it again in as many moves or more, there is nothing new to find -
+    // its subtree was searched already, with as much of the bound left
+    // (or is being searched, and this is a cycle). The same goes for
+    // more moves than it was ever expanded in: every iteration reaches
+    // it in that many again, since the bound only grows. Collisions just
+    // overwrite entries: what's lost is only a shortcut - or, for an
+    // unsolvable board, the proof that it is (see above).
+    //
+    // With 'reduce', which moves are tried from a board depends on the
+    // move that led to it - so that's part of the key: the block moved,
+    // and where it came from.
+    void useTable(size_t bytes) {
+        size_t entries = bytes/sizeof(Entry), size = 2;
+        while (2*size <= entries)
+            size *= 2;
+        _table.assign(entries >= 2 ? size : 0, Entry());
+    }
+
+    void stopWhen(Stop stop) { _stop = stop; }
+
+    // Returns the optimal number of moves, or -1 (see above for when an
+    // unsolvable board is told). 'minMoves' can seed the bound with what
+    // is known already - e.g. that no board within that many moves is a
+    // goal.
+    int solve(State start, std::vector<State> *path = NULL,
+              int minMoves = 0) {
+        _frames.clear();
+        _steps.clear();
+        _start = start;
+        _bound = _estimate(start);
+        if (_bound >= 0)
+            _bound = std::max(_bound, minMoves);
+        return resume(path);
+    }
+
+    // After a solve that stopped: goes on from the board it stopped at,
+    // as if it never had - and can stop (and be resumed) again
+    int resume(std::vector<State> *path = NULL) {
+        _stopped = false;
+        if (_bound < 0)
+            return -1;
+        while (true) {
+            bool found = false;
+            if (_frames.empty()) {
+                _nextBound = INT32_MAX;
+                _iteration++;
+                found = enter(_start, 0, -1, 0, 0);
+            }
+            if (found || search()) {
+                if (path) {
+                    path->clear();
+                    for(size_t k=0; k<_frames.size(); k++)
+                        path->push_back(_frames[k]._state);
+                }
+                int moves = _frames.back()._g;
+                _frames.clear();
+                _steps.clear();
+                return moves;
+            }
+            if (_stopped)
+                return -1;
+            if (_nextBound == INT32_MAX)
+                return -1;
+            _bound = _nextBound;
+        }
+    }
+
+    size_t expanded() const { return _expanded; }
+    // Whether the last solve (or resume) gave up (see stopWhen)
+    bool stopped() const { return _stopped; }
+    size_t tableBytes() const { return _table.size()*sizeof(Entry); }
+
+private:
+    // The tiles block i sweeps, sliding from p to np
+    Cells swept(int i, int p, int np) const {
+        Cells cells = 0;
+        for(int k=std::min(p, np); k<=std::max(p, np); k++)
+            cells |= _puzzle._masks[i][k];
+        return cells;
+    }
+
+    // The depth-first search of an iteration, on a stack of its own - so
+    // that it can stop anywhere, and resume from there. Returns true
+    // once the board on top of the stack is a goal.
+    bool search() {
+        while (!_frames.empty() && !_stopped) {
+            Frame& top = _frames.back();
+            if (top._next == _steps.size()) {
+                _steps.resize(top._first);
+                _frames.pop_back();
+                continue;
+            }
+            Step step = _steps[top._next++];
+            if (enter(step._state, top._g+1, step._block, step._swept,
+                      step._move))
+                return true;
+        }
+        return false;
+    }
+
+    // Reaching 's' in 'g' moves: unless it's cut off, pushes it on the
+    // stack, with the moves to try from it. 'lastMove' tells how 's' was
+    // reached - as far as the reduction cares: the block moved last, and
+    // where from (see useTable).
+    bool enter(State s, int g, int lastBlock, Cells lastSwept,
+               uint64_t lastMove) {
+        int h = _estimate(s);
+        if (h < 0)
+            return false;
+        int f = g + h;
+        uint64_t key = s | lastMove;
+        Entry *slot = _table.empty() ? NULL :
+            &_table[hashState(key) & (_table.size()-2)], *entry = NULL;
+        for(int e=0; slot && e<2; e++)
+            if (slot[e]._iteration && slot[e]._key == key)
+                entry = &slot[e];
+        if (f > _bound) {
+            if (!entry || entry->_fewest > g)
+                _nextBound = std::min(_nextBound, f);
+            return false;
+        }
+        if (slot) {
+            if (entry && (entry->_fewest < g ||
+                    (entry->_iteration == _iteration && entry->_moves <= g)))
+                return false;
+            int fewest = entry ? std::min<int>(entry->_fewest, g) : g;
+            // Two entries per slot: a new board takes an empty one, or
+            // else one not reached in this iteration (yet), or else the
+            // one reached in the most moves - its subtree is the
+            // smallest to lose
+            for(int e=0; !entry && e<2; e++)
+                if (!slot[e]._iteration)
+                    entry = &slot[e];
+            for(int e=0; !entry && e<2; e++)
+                if (slot[e]._iteration != _iteration)
+                    entry = &slot[e];
+            if (!entry)
+                entry = &slot[slot[1]._moves > slot[0]._moves];
+            entry->_key = key;
+            entry->_moves = int16_t(g);
+            entry->_fewest = int16_t(fewest);
+            entry->_iteration = _iteration;
+        }
+        Cells occupied = _puzzle.occupancy(s);
+        State parent = _frames.empty() ? s : _frames.back()._state;
+        Frame frame = { s, g, _steps.size(), _steps.size() };
+        _frames.push_back(frame);
+        _expanded++;
+        if (_puzzle.isGoal(s, occupied))
+            return true;
+        _puzzle.forEachMove(s, occupied, [&](State n, int i, int delta) {
+            if (_reduce && i == lastBlock)
+                return;
+            int p = Puzzle::get(s, i);
+            Cells cells = swept(i, p, p+delta);
+            if (_reduce ? i < lastBlock && !(cells & lastSwept) : n == parent)
+                return;
+            // (States take 54 bits: the move goes in the top ones)
+            uint64_t move = _reduce ?
+                uint64_t((i+1) | (p << 5)) << BITS_PER_BLOCK*MAXBLOCKS : 0;
+            Step step = { n, i, cells, move };
+            _steps.push_back(step);
+        });
+        if (!(_expanded & 1023) && _stop && _stop(_expanded))
+            _stopped = true;
+        return false;
+    }
+
+    struct Entry {
+        uint64_t _key;          // the board, and the move to it
+        int16_t _moves;         // ...in this iteration
+        int16_t _fewest;        // ...expanded in, in any iteration
+        uint32_t _iteration;    // (0: none yet)
+        Entry(): _key(0), _moves(0), _fewest(0), _iteration(0) {}
+    };
+    // A board on the stack, reached in '_g' moves, and the moves from
+    // it: _steps[_first] on, up to the next frame's first (or the end),
+    // of which _next is the next to try
+    struct Frame {
+        State _state;
+        int _g;
+        size_t _first, _next;
+    };
+    struct Step {
+        State _state;
+        int _block;
+        Cells _swept;
+        uint64_t _move;
+    };
+
+    const Puzzle& _puzzle;
+    bool _reduce;
+    size_t _expanded;
+    Estimate _estimate;
+    Stop _stop;
+    bool _stopped;
+    State _start;
+    int _bound, _nextBound;
+    uint32_t _iteration;
+    std::vector<Entry> _table;
+    std::vector<Frame> _frames;
+    std::vector<Step> _steps;
+};
+
+// (With a table of 'tableBytes' - see IDAStar::useTable)
+inline int SolveIDA(const Puzzle& puzzle, State start, bool reduce,
+                    std::vector<State> *path = NULL,
+                    size_t *expanded = NULL,
+                    IDAStar::Estimate estimate = IDAStar::Estimate(),
+                    size_t tableBytes = 0)
+{
+    IDAStar ida(puzzle, reduce, estimate);
+    if (tableBytes)
+        ida.useTable(tableBytes);
+    int depth = ida.solve(start, path);
+    if (expanded) *expanded = ida.expanded();
+    return depth;
+}
+
+// A*, guided by 'estimate' (see IDAStar) - which must also be
+// consistent: a move changes it by one at most, as is the case for
+// exitLaneBlocks and pattern databases. Then a board's first visit is
+// by a shortest path, and no board is ever expanded twice.
+//
+// The priorities (moves so far plus the estimate) are small integers,
+// so the open list is an array of buckets, one per priority. Each
+// bucket is a stack: among boards of equal priority, the last found -
+// the deepest - goes first. The map from each board to how it was
+// reached is also the closed set.
+//
+// Returns the optimal number of moves (-1 if there is no solution), and
+// if 'path' is given, fills it with the boards from 'start' to the goal.
+template <class Estimate>
+int SolveAStar(const Puzzle& puzzle, State start, Estimate estimate,
+               std::vector<State> *path = NULL, size_t *expanded = NULL)
+{
+    struct Node {
+        State _parent;
+        int _moves;
+        bool _closed;
+    };
+    std::unordered_map<State, Node> nodes;
+    std::vector<std::vector<std::pair<State, int> > > buckets;
+    auto open = [&](State s, State parent, int moves, int h) {
+        Node node = { parent, moves, false };
+        nodes[s] = node;
+        if (size_t(moves + h) >= buckets.size())
+            buckets.resize(moves + h + 1);
+        buckets[moves + h].push_back(std::make_pair(s, moves));
+    };
+    size_t examined = 0;
+    int h = estimate(start);
+    if (h >= 0)
+        open(start, start, 0, h);
+    for(size_t f=0; f<buckets.size(); f++) {
+        while (!buckets[f].empty()) {
+            State s = buckets[f].back().first;
+            int moves = buckets[f].back().second;
+            buckets[f].pop_back();
+            Node& node = nodes[s];
+            if (node._closed || node._moves != moves)
+                continue;
+            node._closed = true;
+            Cells occupied = puzzle.occupancy(s);
+            examined++;
+            if (puzzle.isGoal(s, occupied)) {
+                if (expanded) *expanded = examined;
+                if (path) {
+                    path->clear();
+                    for(State p=s; ; p=nodes[p]._parent) {
+                        path->push_back(p);
+                        if (p == start)
+                            break;
+                    }
+                    std::reverse(path->begin(), path->end());
+                }
+                return moves;
+            }
+            puzzle.forEachMove(s, occupied, [&](State n, int, int) {
+                auto it = nodes.find(n);
+                if (it != nodes.end() && it->second._moves <= moves+1)
+                    return;
+                int h = estimate(n);
+                if (h >= 0)
+                    open(n, s, moves+1, h);
+            });
+        }
+    }
+    if (expanded) *expanded = examined;
+    return -1;
+}
+
+// Sorts items by their State key(item) with an LSD radix sort, 8 bits
+// per pass - and only over the bytes that some key actually uses
+// ('scratch' is reused memory). The sort is stable.
+template <class T, class Key>
+void radixSort(std::vector<T>& items, std::vector<T>& scratch, Key key)
+{
+    if (items.size() < 256) {
+        std::stable_sort(items.begin(), items.end(),
+            [&](const T& a, const T& b) { return key(a) < key(b); });
+        return;
+    }
+    State used = 0;
+    for(size_t k=0; k<items.size(); k++)
+        used |= key(items[k]);
+    scratch.resize(items.size());
+    for(int shift=0; shift<64 && (used >> shift); shift+=8) {
+        size_t counts[257];
+        memset(counts, 0, sizeof(counts));
+        for(size_t k=0; k<items.size(); k++)
+            counts[1 + (key(items[k]) >> shift & 255)]++;
+        for(int b=0; b<256; b++)
+            counts[b+1] += counts[b];
+        for(size_t k=0; k<items.size(); k++)
+            scratch[counts[key(items[k]) >> shift & 255]++] = items[k];
+        items.swap(scratch);
+    }
+}
+
+inline void radixSort(std::vector<State>& states, std::vector<State>& scratch)
+{
+    radixSort(states, scratch, [](State s) { return s; });
+}
+
+// The states of a puzzle, numbered in mixed radix: the coordinate of
+// block i is digit i, in base _positions[i]. Like the packed States,
+// the last block is the most significant digit - so the numbers sort
+// in the same order as the States - but they leave no gaps for unused
+// coordinates, so they are far denser.
+class StateKeys {
+public:
+    explicit StateKeys(const Puzzle& puzzle): _count(puzzle._count) {
+        for(int i=0; i<_count; i++)
+            _radix[i] = puzzle._positions[i];
+    }
+    uint64_t key(State s) const {
+        uint64_t k = 0;
+        for(int i=_count; i-- > 0; )
+            k = k*_radix[i] + Puzzle::get(s, i);
+        return k;
+    }
+    State state(uint64_t k) const {
+        State s = 0;
+        for(int i=0; i<_count; i++) {
+            s |= State(k % _radix[i]) << (BITS_PER_BLOCK*i);
+            k /= _radix[i];
+        }
+        return s;
+    }
+private:
+    int _count;
+    uint64_t _radix[MAXBLOCKS];
+};
+
+// The levels of SolveLevels are stored in blocks of LEVEL_BLOCK states,
+// so that they can be walked block by block (e.g. by several threads).
+#define LEVEL_BLOCK 256
+
+// A sorted level of states, kept as a plain vector
+class PlainLevel {
+public:
+    // Takes over the contents of 'sorted'
+    PlainLevel(const StateKeys&, std::vector<State>& sorted) {
+        _states.swap(sorted);
+    }
+    size_t size() const { return _states.size(); }
+    size_t bytes() const { return _states.size()*sizeof(State); }
+    size_t blocks() const { return (size() + LEVEL_BLOCK-1)/LEVEL_BLOCK; }
+    template <class F>
+    void forEachInBlock(size_t b, F f) const {
+        size_t end = std::min(size(), (b+1)*LEVEL_BLOCK);
+        for(size_t k=b*LEVEL_BLOCK; k<end; k++)
+            f(_states[k]);
+    }
+    bool contains(State s) const {
+        return std::binary_search(_states.begin(), _states.end(), s);
+    }
+    const std::vector<State>& states() const { return _states; }
+private:
+    std::vector<State> _states;
+};
+
+// A sorted level of states, compressed: each block keeps the key (see
+// StateKeys) of its first state in a small index, and the rest as
+// differences from the previous key - varint-encoded, 7 bits per byte.
+// In the big levels the keys are close together, so most differences
+// take a byte or two instead of the 8 of a State. Looking a state up
+// is a binary search in the index, then decoding a single block.
+class PackedLevel {
+public:
+    PackedLevel(const StateKeys& keys, std::vector<State>& sorted):
+        _keys(&keys), _size(sorted.size())
+    {
+        uint64_t previous = 0;
+        for(size_t k=0; k<sorted.size(); k++) {
+            uint64_t key = keys.key(sorted[k]);
+            if (k % LEVEL_BLOCK == 0) {
+                _first.push_back(key);
+                _offset.push_back(uint32_t(_bytes.size()));
+            } else {
+                uint64_t delta = key - previous;
+                while (delta >= 128) {
+                    _bytes.push_back((unsigned char)(delta | 128));
+                    delta >>= 7;
+                }
+                _bytes.push_back((unsigned char)delta);
+            }
+            previous = key;
+        }
+        std::vector<State>().swap(sorted);
+    }
+    size_t size() const { return _size; }
+    size_t bytes() const {
+        return _bytes.size() + _first.size()*sizeof(uint64_t) +
+            _offset.size()*sizeof(uint32_t);
+    }
+    size_t blocks() const { return _first.size(); }
+    template <class F>
+    void forEachInBlock(size_t b, F f) const {
+        forEachKey(b, [&](uint64_t key) { f(_keys->state(key)); return true; });
+    }
+    bool contains(State s) const {
+        uint64_t key = _keys->key(s);
+        size_t b = std::upper_bound(_first.begin(), _first.end(), key) -
+            _first.begin();
+        if (!b)
+            return false;
+        bool found = false;
+        forEachKey(b-1, [&](uint64_t k) {
+            found = k == key;
+            return k < key;
+        });
+        return found;
+    }
+private:
+    // Calls f(key) for the keys of block b, until f returns false
+    template <class F>
+    void forEachKey(size_t b, F f) const {
+        size_t count = std::min(_size - b*LEVEL_BLOCK, size_t(LEVEL_BLOCK));
+        const unsigned char *p = _bytes.empty() ? NULL : &_bytes[_offset[b]];
+        uint64_t key = _first[b];
+        if (!f(key))
+            return;
+        for(size_t k=1; k<count; k++) {
+            uint64_t delta = 0;
+            int shift = 0;
+            do {
+                delta |= uint64_t(*p & 127) << shift;
+                shift += 7;
+            } while (*p++ & 128);
+            key += delta;
+            if (!f(key))
+                return;
+        }
+    }
+
+    const StateKeys *_keys;
+    size_t _size;
+    std::vector<uint64_t> _first;
+    std::vector<uint32_t> _offset;
+    std::vector<unsigned char> _bytes;
+};
+
+// Removes from the sorted 'states' those also in the level 'seen'
+template <class Level>
+void subtractLevel(std::vector<State>& states, const Level& seen)
+{
+    size_t out = 0, k = 0, n = states.size();
+    for(size_t b=0; b<seen.blocks(); b++)
+        seen.forEachInBlock(b, [&](State s) {
+            while (k < n && states[k] < s)
+                states[out++] = states[k++];
+            if (k < n && states[k] == s)
+                k++;
+        });
+    while (k < n)
+        states[out++] = states[k++];
+    states.resize(out);
+}
+
+// Generates the level after the last of 'levels' in 'next' - sorted,
+// and stripped of the states of the last two levels. (Slides can be
+// undone, so these are the only levels a move can lead back to.) The
+// moves out of the last level are generated in bulk, duplicates and
+// all, then radix-sorted, made unique and subtracted with linear
+// merges. The expansion is split over as many threads as there are
+// 'generated' buffers.
+template <class Level>
+void expandLevel(const Puzzle& puzzle, const std::vector<Level>& levels,
+                 std::vector<State>& next, std::vector<State>& scratch,
+                 std::vector<std::vector<State> >& generated)
+{
+    const Level& level = levels.back();
+    // Small levels aren't worth the threads
+    unsigned workers = level.size() < 4096 ? 1 : unsigned(generated.size());
+    auto expand = [&](unsigned w) {
+        std::vector<State>& out = generated[w];
+        out.clear();
+        for(size_t b=w; b<level.blocks(); b+=workers)
+            level.forEachInBlock(b, [&](State s) {
+                puzzle.forEachMove(s,
+                    [&](State n, int, int) { out.push_back(n); });
+            });
+    };
+    std::vector<std::thread> pool;
+    for(unsigned w=1; w<workers; w++)
+        pool.push_back(std::thread(expand, w));
+    expand(0);
+    for(size_t w=0; w<pool.size(); w++)
+        pool[w].join();
+
+    next.clear();
+    for(unsigned w=0; w<workers; w++)
+        next.insert(next.end(), generated[w].begin(), generated[w].end());
+    radixSort(next, scratch);
+    next.erase(std::unique(next.begin(), next.end()), next.end());
+    subtractLevel(next, level);
+    if (levels.size() > 1)
+        subtractLevel(next, levels[levels.size()-2]);
+}
+
+// Breadth-first search with no hash table at all: each level is a
+// sorted list of states, made from the one before by expandLevel.
+// Everything is sequential memory access, and the expansion of a level
+// is split over 'threads' threads (0: as many as there are cores).
+//
+// The levels are kept as Level - a PlainLevel, or a PackedLevel to
+// save memory on big searches - so the solution can be walked back:
+// from the goal, to any of its neighbours in the level above, and so
+// on. Returns false if there is no solution; otherwise 'path' holds
+// the boards from 'start' to a goal. If 'levelBytes' is given, it is
+// set to the memory taken by the levels.
+template <class Level>
+bool SolveLevels(const Puzzle& puzzle, State start,
+                 std::vector<State>& path, size_t *expanded = NULL,
+                 unsigned threads = 0, size_t *levelBytes = NULL)
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    StateKeys keys(puzzle);
+    std::vector<Level> levels;
+    std::vector<State> next(1, start), scratch;
+    levels.push_back(Level(keys, next));
+    std::vector<std::vector<State> > generated(threads);
+    size_t examined = 0, bytes = levels.back().bytes();
+    bool solved = false;
+    while (!solved && levels.back().size()) {
+        const Level& level = levels.back();
+        State goal = start;
+        size_t index = 0;
+        for(size_t b=0; b<level.blocks() && !solved; b++)
+            level.forEachInBlock(b, [&](State s) {
+                if (!solved) {
+                    index++;
+                    if (puzzle.isGoal(s)) {
+                        goal = s;
+                        solved = true;
+                    }
+                }
+            });
+        if (solved) {
+            examined += index;
+            int depth = int(levels.size()) - 1;
+            path.assign(depth+1, goal);
+            for(int d=depth-1; d>=0; d--)
+                puzzle.forEachMove(path[d+1],
+                    [&](State n, int, int) {
+                        if (levels[d].contains(n))
+                            path[d] = n;
+                    });
+            break;
+        }
+        examined += level.size();
+        expandLevel(puzzle, levels, next, scratch, generated);
+        levels.push_back(Level(keys, next));
+        bytes += levels.back().bytes();
+    }
+    if (expanded) *expanded = examined;
+    if (levelBytes) *levelBytes = bytes;
+    return solved;
+}
+
+// a += b, stopping at UINT64_MAX instead of wrapping around
+inline void addSaturating(uint64_t& a, uint64_t b)
+{
+    a = a + b < a ? UINT64_MAX : a + b;
+}
+
+// Counts the distinct optimal solutions - the move sequences of minimal
+// length that free the prisoner - e.g. to grade how hard a board is:
+// with a single optimal solution, the player must find each move.
+//
+// The levels are built as in SolveLevels, up to the first one holding a
+// goal. Then the number of shortest paths to each state is propagated
+// down the levels: a state of level d+1 gets the sum of the counts of
+// its neighbours in level d. The counts are flat arrays, parallel to
+// the sorted levels. The moves out of level d are radix-sorted along
+// with the counts they carry, then merged with level d+1 in a single
+// linear pass - moves back to levels d-1 and d find no match there, and
+// are dropped. The counts saturate at UINT64_MAX instead of wrapping.
+//
+// Returns the optimal number of moves (or -1 if there is no solution),
+// and sets 'count' to the number of optimal solutions.
+inline int CountOptimalSolutions(const Puzzle& puzzle, State start,
+                                 uint64_t& count, size_t *expanded = NULL)
+{
+    StateKeys keys(puzzle);
+    std::vector<PlainLevel> levels;
+    std::vector<State> next(1, start), scratch;
+    levels.push_back(PlainLevel(keys, next));
+    std::vector<std::vector<State> > generated(1);
+    size_t examined = 0;
+    count = 0;
+    auto hasGoal = [&](const std::vector<State>& level) {
+        for(size_t k=0; k<level.size(); k++)
+            if (puzzle.isGoal(level[k]))
+                return true;
+        return false;
+    };
+    while (levels.back().size() && !hasGoal(levels.back().states())) {
+        examined += levels.back().size();
+        expandLevel(puzzle, levels, next, scratch, generated);
+        levels.push_back(PlainLevel(keys, next));
+    }
+    examined += levels.back().size();
+    if (expanded) *expanded = examined;
+    if (!levels.back().size())
+        return -1;
+
+    typedef std::pair<State, uint64_t> Edge;  // successor, paths to it
+    std::vector<Edge> edges, edgeScratch;
+    std::vector<uint64_t> counts(1, 1), below;
+    for(size_t d=0; d+1<levels.size(); d++) {
+        const std::vector<State>& level = levels[d].states();
+        const std::vector<State>& lower = levels[d+1].states();
+        edges.clear();
+        for(size_t k=0; k<level.size(); k++)
+            puzzle.forEachMove(level[k], [&](State n, int, int) {
+                edges.push_back(Edge(n, counts[k]));
+            });
+        radixSort(edges, edgeScratch, [](const Edge& e) { return e.first; });
+        below.assign(lower.size(), 0);
+        size_t j = 0;
+        for(size_t e=0; e<edges.size() && j<lower.size(); e++) {
+            while (j < lower.size() && lower[j] < edges[e].first)
+                j++;
+            if (j < lower.size() && lower[j] == edges[e].first)
+                addSaturating(below[j], edges[e].second);
+        }
+        counts.swap(below);
+    }
+    const std::vector<State>& goals = levels.back().states();
+    for(size_t k=0; k<goals.size(); k++)
+        if (puzzle.isGoal(goals[k]))
+            addSaturating(count, counts[k]);
+    return int(levels.size()) - 1;
+}
+
+// The same, with the levels as plain vectors
+inline bool SolveSorted(const Puzzle& puzzle, State start,
+                        std::vector<State>& path, size_t *expanded = NULL,
+                        unsigned threads = 0)
+{
+    return SolveLevels<PlainLevel>(puzzle, start, path, expanded, threads);
+}
+
+// Re-planning, for when the player strays from a plan. This is the BFS
+// of SolveDepth, plus the parents needed to return the boards of the new
+// plan - and a shortcut: the boards of the previous plan are given, and
+// their distance from the goal is known. Meeting one of them is as good
+// as meeting a goal, as soon as we know nothing shorter can exist.
+//
+// The hash table and frontiers are kept across calls (clear() keeps
+// their memory), so a re-plan doesn't start with allocations.
+class Planner {
+public:
+    // 'known' holds the boards of an optimal plan, the last being a goal.
+    // 'lowerBound' is a length no plan from 'start' can beat (if 'start'
+    // is one slide away from known[0], it is known.size()-2).
+    //
+    // Returns false if there is no solution; otherwise 'path' holds the
+    // boards from 'start' to a goal. If 'expanded' is given, it is set
+    // to the number of states examined.
+    bool replan(const Puzzle& puzzle, State start,
+                const std::vector<State>& known, int lowerBound,
+                std::vector<State>& path, size_t *expanded = NULL)
+    {
+        _remaining.clear();
+        for(size_t k=0; k<known.size(); k++)
+            _remaining[known[k]] = int(known.size()-1 - k);
+        _parent.clear();
+        _parent[start] = start;
+        _frontier.assign(1, start);
+
+        int best = -1;
+        State via = start;
+        size_t examined = 0;
+        for(int depth=0; !_frontier.empty(); depth++) {
+            for(size_t k=0; k<_frontier.size(); k++) {
+                State s = _frontier[k];
+                std::unordered_map<State, int>::const_iterator it =
+                    _remaining.find(s);
+                int r = it != _remaining.end() ? it->second :
+                    puzzle.isGoal(s) ? 0 : -1;
+                if (r >= 0 && (best < 0 || depth + r < best)) {
+                    best = depth + r;
+                    via = s;
+                }
+            }
+            // Any plan we haven't met yet is at least depth+1 moves long
+            if (best >= 0 && (best <= depth+1 || best <= lowerBound))
+                break;
+            _next.clear();
+            for(size_t k=0; k<_frontier.size(); k++) {
+                State s = _frontier[k];
+                examined++;
+                puzzle.forEachMove(s,
+                    [&](State n, int, int) {
+                        if (_parent.insert(std::make_pair(n, s)).second)
+                            _next.push_back(n);
+                    });
+            }
+            _frontier.swap(_next);
+        }
+        if (expanded) *expanded = examined;
+        if (best < 0)
+            return false;
+
+        // Back from 'via' to the start - then on along the known plan
+        path.clear();
+        for(State s=via; ; s=_parent[s]) {
+            path.push_back(s);
+            if (s == start)
+                break;
+        }
+        std::reverse(path.begin(), path.end());
+        std::vector<State>::const_iterator it =
+            std::find(known.begin(), known.end(), via);
+        if (it != known.end())
+            path.insert(path.end(), it+1, known.end());
+        return true;
+    }
+
+private:
+    std::unordered_map<State, int> _remaining;
+    std::unordered_map<State, State> _parent;
+    std::vector<State> _frontier, _next;
+};
+
+// For each block, the last one before it that can't be told apart from
+// it - on the same lane, as long, and neither of them the prisoner - or
+// -1. Swapping two such blocks gives the same board; and since blocks on
+// a lane can't pass each other, no move ever swaps them.
+inline std::vector<int> identicalBlocks(const Puzzle& puzzle)
+{
+    std::vector<int> twins(puzzle._count, -1);
+    for(int i=0; i<puzzle._count; i++)
+        for(int j=0; j<i; j++)
+            if (i != puzzle._prisoner && j != puzzle._prisoner &&
+                    puzzle._isHorizontal[i] == puzzle._isHorizontal[j] &&
+                    puzzle._lane[i] == puzzle._lane[j] &&
+                    puzzle._length[i] == puzzle._length[j])
+                twins[i] = j;
+    return twins;
+}
+
+// 's', with the blocks that can't be told apart (see identicalBlocks)
+// in index order along their lane - the same board, in one spelling
+inline State canonicalState(const std::vector<int>& twins, State s)
+{
+    for(int i=0; i<int(twins.size()); i++)
+        for(int j=i; twins[j] >= 0 &&
+                Puzzle::get(s, twins[j]) > Puzzle::get(s, j); j=twins[j]) {
+            int p = Puzzle::get(s, j);
+            s = Puzzle::set(s, j, Puzzle::get(s, twins[j]));
+            s = Puzzle::set(s, twins[j], p);
+        }
+    return s;
+}
+
+template <class F>
+void forEachPlacement(const Puzzle& puzzle, const std::vector<int>& twins,
+                      F& f, int i, State s, Cells occupied)
+{
+    if (i == puzzle._count) {
+        f(s);
+        return;
+    }
+    int first = twins[i] < 0 ? 0 : Puzzle::get(s, twins[i]) + 1;
+    for(int p=first; p<puzzle._positions[i]; p++)
+        if (!(occupied & puzzle._masks[i][p]))
+            forEachPlacement(puzzle, twins, f, i+1, Puzzle::set(s, i, p),
+                             occupied | puzzle._masks[i][p]);
+}
+
+// Calls f(state) for every legal placement of the puzzle's blocks -
+// i.e. every board that can be made out of this set of blocks, once:
+// in canonicalState's spelling.
+template <class F>
+void forEachLegalState(const Puzzle& puzzle, F f)
+{
+    forEachPlacement(puzzle, identicalBlocks(puzzle), f, 0, 0, 0);
+}
+
+// The distance of every board of a block set from its nearest goal,
+// computed by a backward BFS that starts from all the goal boards at
+// once. Since every slide can be undone, walking backwards from the
+// goals is the same as walking forward - and the boards at maximum
+// distance are the hardest starting positions for this block set.
+struct GoalDistances {
+    std::vector<State> _states;       // all legal boards, sorted
+    std::vector<signed char> _depth;  // -1 for boards with no solution
+    std::vector<size_t> _histogram;   // boards per distance
+    size_t _solvable;
+    std::vector<int> _twins;          // see identicalBlocks
+
+    int maxDepth() const { return int(_histogram.size()) - 1; }
+
+    // The optimal number of moves from 's', or -1 if it has no solution
+    int depth(State s) const {
+        s = canonicalState(_twins, s);
+        std::vector<State>::const_iterator it =
+            std::lower_bound(_states.begin(), _states.end(), s);
+        if (it == _states.end() || *it != s)
+            return -1;
+        return _depth[it - _states.begin()];
+    }
+};
+
+inline void ReverseBFS(const Puzzle& puzzle, GoalDistances& result)
+{
+    result._states.clear();
+    result._twins = identicalBlocks(puzzle);
+    forEachLegalState(puzzle,
+        [&](State s) { result._states.push_back(s); });
+    std::sort(result._states.begin(), result._states.end());
+    result._depth.assign(result._states.size(), -1);
+    result._histogram.clear();
+    result._solvable = 0;
+
+    std::vector<size_t> frontier, next;
+    for(size_t k=0; k<result._states.size(); k++)
+        if (puzzle.isGoal(result._states[k])) {
+            result._depth[k] = 0;
+            frontier.push_back(k);
+        }
+    for(int depth=0; !frontier.empty(); depth++) {
+        result._histogram.push_back(frontier.size());
+        result._solvable += frontier.size();
+        next.clear();
+        for(size_t k=0; k<frontier.size(); k++)
+            puzzle.forEachMove(result._states[frontier[k]],
+                [&](State n, int, int) {
+                    size_t idx = std::lower_bound(
+                        result._states.begin(), result._states.end(), n)
+                        - result._states.begin();
+                    if (result._depth[idx] < 0) {
+                        result._depth[idx] = depth+1;
+                        next.push_back(idx);
+                    }
+                });
+        frontier.swap(next);
+    }
+}
+
+#endif
@@ -0,0 +1,300 @@
+// Loading of the RGB frames that the detection code looks at.
+//
+// Detection only samples a few hundred pixels of each 480x320 frame,
+// so copying the whole frame into a buffer (as we used to, with an
+// ifstream) is wasted work - even more so in batch jobs over thousands
+// of frames. Instead, we memory-map the file, and the detectors read
+// through an ImageView - only the pages they touch are ever read in.
+//
+// Pipes (and stdin) can't be mapped, so for those we fall back to
+// reading the data into a buffer - and give out a view over that.
+//
+// And when frames sit on network-backed or cold storage, even mapping
+// means waiting for every page we touch, one fault at a time. SparseFrame
+// fetches nothing but the pixels detection samples instead.
+//
+// Finally, a camera (or screen grabber) feeding us live frames gives us
+// a pipe with one raw frame after the other - FrameStream reads those.
+
+#ifndef UNBLOCK_FRAME_H
+#define UNBLOCK_FRAME_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// The dimensions of the iPhone snapshots
+#define FRAME_WIDTH  320
+#define FRAME_HEIGHT 480
+
+// A read-only view of RGB pixels, wherever they live. Consecutive pixels
+// of a line are 'pixelStride' bytes apart, and consecutive lines are
+// 'lineStride' bytes apart - so the same view can walk over packed RGB,
+// RGBA, or lines with padding. Alternatively, the lines can be scattered
+// anywhere in memory, and be given as a table of line pointers.
+struct ImageView {
+    const unsigned char *_data;
+    const unsigned char * const *_lines;
+    unsigned _width, _height;
+    size_t _lineStride;
+    unsigned _pixelStride;
+
+    ImageView():
+        _data(NULL), _lines(NULL), _width(0), _height(0), _lineStride(0),
+        _pixelStride(0)
+        {}
+    ImageView(const unsigned char *data, unsigned width, unsigned height,
+              size_t lineStride, unsigned pixelStride):
+        _data(data), _lines(NULL), _width(width), _height(height),
+        _lineStride(lineStride), _pixelStride(pixelStride)
+        {}
+    ImageView(const unsigned char * const *lines, unsigned width,
+              unsigned height, unsigned pixelStride):
+        _data(NULL), _lines(lines), _width(width), _height(height),
+        _lineStride(0), _pixelStride(pixelStride)
+        {}
+
+    // The R, G and B bytes of a pixel, i.e. 'arr[line][column][0..2]'
+    const unsigned char *operator()(unsigned line, unsigned column) const {
+        const unsigned char *start =
+            _lines ? _lines[line] : _data + line*_lineStride;
+        return start + column*_pixelStride;
+    }
+};
+
+// A raw RGB frame file (as made by "convert IMG_0354.PNG data.rgb").
+// Regular files are mapped; anything else is read into a buffer.
+class FrameFile {
+public:
+    FrameFile(): _mapped(NULL), _mappedSize(0) {}
+    ~FrameFile() { close(); }
+
+    // Opens 'path' ("-" for stdin). On failure, returns false
+    // and explains why in 'error'.
+    bool open(const std::string& path, unsigned width, unsigned height,
+              std::string& error)
+    {
+        close();
+        size_t size = size_t(width)*height*3;
+        int fd = path == "-" ? 0 : ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open '" + path + "'";
+            return false;
+        }
+        struct stat st;
+        bool ok = false;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (size_t(st.st_size) < size)
+                error = "'" + path + "' is too small for the frame";
+            else {
+                void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    // We only sample a few lines - don't read ahead
+                    madvise(p, size, MADV_RANDOM);
+                    _mapped = static_cast<unsigned char*>(p);
+                    _mappedSize = size;
+                    _view = ImageView(_mapped, width, height, width*3, 3);
+                    ok = true;
+                }
+            }
+        }
+        if (!ok && error.empty()) {
+            // A pipe - or a file we couldn't map: read it all
+            _buffer.resize(size);
+            size_t got = 0;
+            while (got < size) {
+                ssize_t n = read(fd, &_buffer[got], size - got);
+                if (n <= 0)
+                    break;
+                got += n;
+            }
+            if (got == size) {
+                _view = ImageView(&_buffer[0], width, height, width*3, 3);
+                ok = true;
+            } else
+                error = "failed to read a whole frame from '" + path + "'";
+        }
+        if (fd != 0)
+            ::close(fd);
+        return ok;
+    }
+
+    void close() {
+        if (_mapped)
+            munmap(_mapped, _mappedSize);
+        _mapped = NULL;
+        _mappedSize = 0;
+        _view = ImageView();
+    }
+
+    const ImageView& view() const { return _view; }
+
+private:
+    FrameFile(const FrameFile&);
+    FrameFile& operator=(const FrameFile&);
+
+    unsigned char *_mapped;
+    size_t _mappedSize;
+    std::vector<unsigned char> _buffer;
+    ImageView _view;
+};
+
+// A raw RGB frame file, of which we only read the pixels at the given
+// lines and columns. The byte offsets of these pixels are computed once,
+// when the SparseFrame is created - then each frame costs one pread per
+// sampled line.
+//
+// Why per line, and not per pixel? The pixels of a line are a mere
+// 150 bytes apart, so the whole span between the first and last one
+// comes from the same disk block or page anyway; reading it in one go
+// costs the same I/O as reading the pixels alone, in 1/6th of the
+// syscalls. (For the same reason, vectored preadv doesn't help here -
+// it only scatters a *contiguous* file range.) Instead, before reading,
+// we tell the kernel about all the spans, so that on cold storage they
+// are all fetched concurrently rather than one after the other.
+class SparseFrame {
+public:
+    SparseFrame(unsigned width, unsigned height,
+                const std::vector<unsigned>& lines,
+                const std::vector<unsigned>& columns):
+        _width(width), _height(height), _linePointers(height, NULL)
+    {
+        unsigned first = width, last = 0;
+        for(size_t k=0; k<columns.size(); k++) {
+            first = std::min(first, columns[k]);
+            last = std::max(last, columns[k]);
+        }
+        // Each sampled line gets a buffer big enough to address its
+        // pixels by column; only the [first, last] span is read into it.
+        _lineSize = (last+1)*3;
+        std::vector<bool> taken(height, false);
+        for(size_t k=0; k<lines.size(); k++) {
+            if (lines[k] >= height || taken[lines[k]])
+                continue;
+            taken[lines[k]] = true;
+            Span span;
+            span._line = lines[k];
+            span._fileOffset = (off_t(lines[k])*width + first)*3;
+            span._bufferOffset = _spans.size()*_lineSize + first*3;
+            span._length = (last - first + 1)*3;
+            _spans.push_back(span);
+        }
+        _buffer.resize(_spans.size()*_lineSize);
+        for(size_t k=0; k<_spans.size(); k++)
+            _linePointers[_spans[k]._line] = &_buffer[k*_lineSize];
+        // (the view has the frame's size, though only the sampled
+        // pixels are there)
+        _view = ImageView(&_linePointers[0], width, height, 3);
+    }
+
+    // Reads the sampled pixels of the frame in 'path'. On failure,
+    // returns false and explains why in 'error'.
+    bool open(const std::string& path, std::string& error)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open '" + path + "'";
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 ||
+                size_t(st.st_size) < size_t(_width)*_height*3) {
+            ::close(fd);
+            error = "'" + path + "' is too small for the frame";
+            return false;
+        }
+        for(size_t k=0; k<_spans.size(); k++)
+            posix_fadvise(fd, _spans[k]._fileOffset, _spans[k]._length,
+                          POSIX_FADV_WILLNEED);
+        bool ok = true;
+        for(size_t k=0; k<_spans.size() && ok; k++)
+            ok = pread(fd, &_buffer[_spans[k]._bufferOffset],
+                       _spans[k]._length, _spans[k]._fileOffset)
+                == ssize_t(_spans[k]._length);
+        ::close(fd);
+        if (!ok)
+            error = "failed to read the pixels of '" + path + "'";
+        return ok;
+    }
+
+    const ImageView& view() const { return _view; }
+
+private:
+    SparseFrame(const SparseFrame&);
+    SparseFrame& operator=(const SparseFrame&);
+
+    struct Span {
+        unsigned _line;
+        off_t _fileOffset;
+        size_t _bufferOffset, _length;
+    };
+
+    unsigned _width, _height;
+    size_t _lineSize;
+    std::vector<Span> _spans;
+    std::vector<unsigned char> _buffer;
+    std::vector<const unsigned char*> _linePointers;
+    ImageView _view;
+};
+
+// Consecutive raw RGB frames, from a pipe (or stdin, or a file holding
+// many frames back to back). Each call to next() reads the next frame
+// into the same buffer - so the view stays valid, and shows the latest.
+class FrameStream {
+public:
+    FrameStream(): _fd(-1) {}
+    ~FrameStream() { close(); }
+
+    // Opens 'path' ("-" for stdin). On failure, returns false
+    // and explains why in 'error'.
+    bool open(const std::string& path, unsigned width, unsigned height,
+              std::string& error)
+    {
+        close();
+        _fd = path == "-" ? 0 : ::open(path.c_str(), O_RDONLY);
+        if (_fd < 0) {
+            error = "cannot open '" + path + "'";
+            return false;
+        }
+        _buffer.resize(size_t(width)*height*3);
+        _view = ImageView(&_buffer[0], width, height, width*3, 3);
+        return true;
+    }
+
+    // Reads the next frame. Returns false at the end of the stream
+    // (a partial frame at the end is dropped).
+    bool next() {
+        size_t got = 0, size = _buffer.size();
+        while (got < size) {
+            ssize_t n = read(_fd, &_buffer[got], size - got);
+            if (n <= 0)
+                return false;
+            got += n;
+        }
+        return true;
+    }
+
+    void close() {
+        if (_fd > 0)
+            ::close(_fd);
+        _fd = -1;
+    }
+
+    const ImageView& view() const { return _view; }
+
+private:
+    FrameStream(const FrameStream&);
+    FrameStream& operator=(const FrameStream&);
+
+    int _fd;
+    std::vector<unsigned char> _buffer;
+    ImageView _view;
+};
+
+#endif
@@ -0,0 +1,196 @@
+// Random board generator, for building benchmark corpora.
+//
+// We only have four screenshots to benchmark against - this tool
+// creates as many boards as we want, by placing random blocks on
+// an empty 6x6 board. Each board is solved with the packed-state
+// engine (Unblock-engine.h), so we can keep only the solvable ones,
+// and only those whose optimal solution is within a depth range.
+//
+// Output is one board per line (see formatBoard), followed by the
+// optimal number of moves - so corpora can be streamed, concatenated
+// and split with the usual line-based tools:
+//
+//     ZZ.A..B..A..BCCD..E..D..E...FF.GGG.. 14
+//
+// With -c, the line also gives the number of distinct optimal solutions
+// (see CountOptimalSolutions) - the fewer, the harder the board tends
+// to be, for the same depth.
+//
+// Lines starting with '#' are comments.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "Unblock-engine.h"
+
+using namespace std;
+
+// The row of the exit - the "freedom path" drawn by printBoard
+#define EXIT_ROW 2
+
+// We give up after this many boards in a row fail the -b/-d/-u filters:
+// the options likely ask for boards that don't exist (say, 60 moves)
+#define MAX_REJECTED 10000
+
+void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " [options]\n\n";
+    cerr << "  -s seed     random seed (default: 1)\n";
+    cerr << "  -n count    how many boards to emit (default: 1000)\n";
+    cerr << "  -b min:max  blocks besides the prisoner (default: 8:13)\n";
+    cerr << "  -l ratio    fraction of blocks that are 3 tiles long\n";
+    cerr << "              (default: 0.25)\n";
+    cerr << "  -v ratio    fraction of blocks that are vertical\n";
+    cerr << "              (default: 0.5)\n";
+    cerr << "  -p column   starting column of the prisoner, 0-4\n";
+    cerr << "              (default: random)\n";
+    cerr << "  -d min:max  keep boards whose optimal solution needs\n";
+    cerr << "              min to max moves (default: 1:1000)\n";
+    cerr << "  -u          keep unsolvable boards too (depth -1)\n";
+    cerr << "  -c          also emit how many optimal solutions each\n";
+    cerr << "              board has\n";
+    exit(1);
+}
+
+// Parses "min:max" (or a single number, meaning min=max)
+bool parseRange(const char *text, int& lo, int& hi)
+{
+    if (2 == sscanf(text, "%d:%d", &lo, &hi))
+        return lo <= hi;
+    if (1 == sscanf(text, "%d", &lo)) {
+        hi = lo;
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long seed = 1;
+    long count = 1000;
+    int minBlocks = 8, maxBlocks = 13;
+    double longRatio = 0.25, verticalRatio = 0.5;
+    int prisonerColumn = -1;
+    int minDepth = 1, maxDepth = 1000;
+    bool keepUnsolvable = false, countSolutions = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:b:l:v:p:d:uc")) != -1) {
+        switch (opt) {
+        case 's': seed = strtoul(optarg, NULL, 10); break;
+        case 'n': count = atol(optarg); break;
+        case 'b':
+            if (!parseRange(optarg, minBlocks, maxBlocks) ||
+                    minBlocks < 0 || maxBlocks >= MAXBLOCKS)
+                usage(argv[0]);
+            break;
+        case 'l':
+            longRatio = atof(optarg);
+            if (longRatio < 0 || longRatio > 1)
+                usage(argv[0]);
+            break;
+        case 'v':
+            verticalRatio = atof(optarg);
+            if (verticalRatio < 0 || verticalRatio > 1)
+                usage(argv[0]);
+            break;
+        case 'p':
+            prisonerColumn = atoi(optarg);
+            if (prisonerColumn < 0 || prisonerColumn > SIZE-2)
+                usage(argv[0]);
+            break;
+        case 'd':
+            if (!parseRange(optarg, minDepth, maxDepth) || maxDepth < 0)
+                usage(argv[0]);
+            break;
+        case 'u': keepUnsolvable = true; break;
+        case 'c': countSolutions = true; break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> coin(0.0, 1.0);
+
+    // Record how the corpus was made, so it can be re-created
+    cout << "# Unblock-generate -s " << seed << " -n " << count;
+    cout << " -b " << minBlocks << ":" << maxBlocks << " -l " << longRatio;
+    cout << " -v " << verticalRatio << " -d " << minDepth << ":" << maxDepth;
+    if (prisonerColumn >= 0) cout << " -p " << prisonerColumn;
+    if (keepUnsolvable) cout << " -u";
+    if (countSolutions) cout << " -c";
+    cout << "\n";
+
+    long emitted = 0, tried = 0, rejected = 0;
+    while (emitted < count) {
+        if (rejected == MAX_REJECTED) {
+            cout.flush();
+            cerr << "Giving up: the last " << rejected << " boards were ";
+            cerr << "all rejected - are there boards like that?\n";
+            cerr << "Emitted " << emitted << " boards out of ";
+            cerr << tried << " generated.\n";
+            return 1;
+        }
+        tried++;
+        rejected++;
+        Puzzle puzzle;
+        State state = 0;
+        Cells occupied = 0;
+
+        // The prisoner always sits on the exit row
+        int px = prisonerColumn >= 0 ?
+            prisonerColumn : int(rng() % (SIZE-1));
+        puzzle.addBlock(EXIT_ROW, px, true, 2, true, state);
+        occupied = puzzle.occupancy(state);
+
+        // Then throw in blocks, until we have as many as we want -
+        // or we fail to find room for them too many times in a row.
+        int wanted = minBlocks + int(rng() % (maxBlocks - minBlocks + 1));
+        int failures = 0;
+        while (puzzle._count-1 < wanted && failures < 100) {
+            bool isHorizontal = coin(rng) >= verticalRatio;
+            int length = coin(rng) < longRatio ? 3 : 2;
+            int lane = int(rng() % SIZE);
+            int pos = int(rng() % (SIZE - length + 1));
+            int y = isHorizontal ? lane : pos;
+            int x = isHorizontal ? pos : lane;
+            // A horizontal block on the exit row, in front of the
+            // prisoner, can never get out of his way.
+            Cells mask = 0;
+            for(int j=0; j<length; j++)
+                mask |= isHorizontal ? tileBit(y, x+j) : tileBit(y+j, x);
+            if ((mask & occupied) ||
+                    (isHorizontal && y == EXIT_ROW && x > px)) {
+                failures++;
+                continue;
+            }
+            failures = 0;
+            puzzle.addBlock(y, x, isHorizontal, length, false, state);
+            occupied |= mask;
+        }
+        if (puzzle._count-1 < minBlocks)
+            continue;
+
+        uint64_t solutions = 0;
+        int depth = countSolutions ?
+            CountOptimalSolutions(puzzle, state, solutions) :
+            SolveDepth(puzzle, state);
+        if (depth < 0 ? !keepUnsolvable :
+                (depth < minDepth || depth > maxDepth))
+            continue;
+        cout << formatBoard(puzzle, state) << " " << depth;
+        if (countSolutions)
+            cout << " " << solutions;
+        cout << "\n";
+        emitted++;
+        rejected = 0;
+    }
+    cout.flush();
+    cerr << "Emitted " << emitted << " boards out of ";
+    cerr << tried << " generated.\n";
+}
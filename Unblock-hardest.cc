@@ -0,0 +1,128 @@
+// Hardest-board search, via backward BFS from all the goal boards.
+//
+// SolveBoard only ever meets a hard board by chance; this tool finds
+// the hardest ones on purpose. For every block set it is given (read
+// from stdin, in the corpus format of Unblock-generate - the block
+// positions on each line are ignored, only the set of blocks matters)
+// it enumerates every legal placement of these blocks - once for each
+// board, so blocks that can't be told apart are never just swapped
+// (see identicalBlocks) - and runs a backward BFS from all goal
+// placements at once (see ReverseBFS).
+//
+// It then reports the depth histogram, followed by the boards at
+// maximum distance - in the corpus format, so they can be fed to the
+// benchmarks directly. Block sets are processed in parallel.
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+
+#include "Unblock-engine.h"
+
+using namespace std;
+
+void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " [options] < boards.txt\n\n";
+    cerr << "  -j threads  how many block sets to search in parallel\n";
+    cerr << "              (default: all cores, at most 4 per core)\n";
+    cerr << "  -m count    emit at most this many hardest boards per set\n";
+    cerr << "              (default: 10, 0 for all)\n";
+    exit(1);
+}
+
+// Searches one block set, and returns the report for it
+string SearchBlockSet(const string& line, size_t maxEmitted)
+{
+    ostringstream out;
+    string board;
+    istringstream(line) >> board;
+    out << "# block set of " << board << "\n";
+
+    Puzzle puzzle;
+    State state;
+    string error;
+    if (!parseBoard(board, puzzle, state, error)) {
+        out << "# error: " << error << "\n";
+        return out.str();
+    }
+
+    GoalDistances distances;
+    ReverseBFS(puzzle, distances);
+    out << "# boards " << distances._states.size();
+    out << ", solvable " << distances._solvable;
+    // (e.g. a block in the prisoner's row, that can't get out of it)
+    if (distances.maxDepth() < 0) {
+        out << ", no solvable placement\n";
+        return out.str();
+    }
+    out << ", hardest " << distances.maxDepth() << " moves (";
+    out << distances._histogram.back() << " boards)\n";
+    out << "# histogram";
+    for(size_t d=0; d<distances._histogram.size(); d++)
+        out << " " << d << ":" << distances._histogram[d];
+    out << "\n";
+
+    size_t emitted = 0;
+    for(size_t k=0; k<distances._states.size(); k++) {
+        if (distances._depth[k] != distances.maxDepth())
+            continue;
+        if (maxEmitted && emitted++ == maxEmitted)
+            break;
+        out << formatBoard(puzzle, distances._states[k]);
+        out << " " << distances.maxDepth() << "\n";
+    }
+    return out.str();
+}
+
+int main(int argc, char *argv[])
+{
+    // (hardware_concurrency may not know - then it says 0)
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    unsigned threads = cores;
+    size_t maxEmitted = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:m:")) != -1) {
+        switch (opt) {
+        case 'j': {
+            char *end;
+            long n = strtol(optarg, &end, 10);
+            if (end == optarg || *end || n < 1 || n > 4L*cores)
+                usage(argv[0]);
+            threads = unsigned(n);
+            break;
+        }
+        case 'm': maxEmitted = atol(optarg); break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    vector<string> blockSets;
+    string line;
+    while (getline(cin, line))
+        if (!line.empty() && line[0] != '#')
+            blockSets.push_back(line);
+
+    // Each worker grabs the next block set that nobody searched yet;
+    // the reports are printed in input order, once all are done.
+    vector<string> reports(blockSets.size());
+    atomic<size_t> nextSet(0);
+    vector<thread> workers;
+    for(unsigned t=0; t<threads; t++)
+        workers.push_back(thread([&]() {
+            size_t k;
+            while ((k = nextSet++) < blockSets.size())
+                reports[k] = SearchBlockSet(blockSets[k], maxEmitted);
+        }));
+    for(size_t t=0; t<workers.size(); t++)
+        workers[t].join();
+
+    for(size_t k=0; k<reports.size(); k++)
+        cout << reports[k];
+}
@@ -0,0 +1,259 @@
+// Finding the board in frames of any resolution.
+//
+// The detectors were written against the 480x320 iPhone snapshots,
+// where the tile centers are at lines 145 + y*50 and columns 34 + x*50.
+// Other phones give other resolutions (and aspect ratios) - so here we
+// locate the tile area of the board, and scale the sampling points of
+// the original snapshots to it.
+//
+// The tile area is surrounded by the light wooden frame of the board -
+// so we look at projections: the fraction of "wood" pixels per column,
+// and per line. Columns crossing the tile area have little wood in them;
+// the frame's edges are almost all wood. First we do this over a
+// coarse, subsampled version of the frame (one pixel out of 'step' in
+// each direction) to find the board roughly; then at full resolution,
+// but only in narrow bands around the edges we found. Last, the size of
+// the tiles comes from where exactly the wood ends, to a fraction of a
+// pixel - resampled frames blur the edges.
+
+#ifndef UNBLOCK_LOCATE_H
+#define UNBLOCK_LOCATE_H
+
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "Unblock-frame.h"
+
+// The board is SIZE x SIZE tiles
+#define SIZE 6
+
+// Where the tiles are: the top-left corner of the tile area, and the
+// size of each tile. The sampling points are those of the original
+// snapshots - whose tile area starts at line 121 and column 10, with
+// 50-pixel tiles - scaled to this geometry.
+struct BoardGeometry {
+    double _top, _left, _pitch;
+
+    BoardGeometry(): _top(121), _left(10), _pitch(50) {}
+
+    // The center line of tile row y, and center column of tile column x
+    unsigned line(int y) const {
+        return scaled(_top, 145 + 50*y - 121);
+    }
+    unsigned column(int x) const {
+        return scaled(_left, 34 + 50*x - 10);
+    }
+    // The lines where we look for the borders of tile row y: the
+    // highlight along the top of a block (lines 122-123 of the snapshots,
+    // for row 0), and the shadow under it (168-169). Resampled frames
+    // blend these with the dark lines around them - so we look inside,
+    // and the highlight's first line more than its second one (which is
+    // not as bright on the prisoner).
+    unsigned topBorder(int y) const {
+        return scaled(_top, 122.25 + 50*y - 121);
+    }
+    unsigned bottomBorder(int y) const {
+        return scaled(_top, 168.5 + 50*y - 121);
+    }
+
+private:
+    // The pixel 'offset' snapshot pixels into the tile area, from 'start'
+    // (scaling the centers of the pixels, not their top-left corners)
+    unsigned scaled(double start, double offset) const {
+        return unsigned(start + _pitch*(offset + 0.5)/50);
+    }
+};
+
+// The colour of the board's wooden frame (but not the brighter
+// highlights along the top edges of the blocks)
+inline bool isWood(const unsigned char *p)
+{
+    return p[0] > 130 && p[0] < 195 && p[1] > 95 && p[1] < 145 &&
+        p[2] > 25 && p[2] < 70;
+}
+
+// Fraction of wood in a column, over lines [from, to) every 'step'
+inline double woodInColumn(const ImageView& image, unsigned x,
+                           unsigned from, unsigned to, unsigned step)
+{
+    unsigned total = 0, wood = 0;
+    for(unsigned y=from; y<to; y+=step, total++)
+        wood += isWood(image(y, x));
+    return total ? double(wood)/total : 0;
+}
+
+// Fraction of wood in a line, over columns [from, to) every 'step'
+inline double woodInLine(const ImageView& image, unsigned y,
+                         unsigned from, unsigned to, unsigned step)
+{
+    unsigned total = 0, wood = 0;
+    for(unsigned x=from; x<to; x+=step, total++)
+        wood += isWood(image(y, x));
+    return total ? double(wood)/total : 0;
+}
+
+// Mean red of a column, over lines [from, to) - where the wood is far
+// brighter than the dark line around the tile area
+inline double redInColumn(const ImageView& image, unsigned x,
+                          unsigned from, unsigned to)
+{
+    double red = 0;
+    for(unsigned y=from; y<to; y++)
+        red += image(y, x)[0];
+    return to > from ? red/(to - from) : 0;
+}
+
+// Mean red of a line, over columns [from, to)
+inline double redInLine(const ImageView& image, unsigned y,
+                        unsigned from, unsigned to)
+{
+    double red = 0;
+    for(unsigned x=from; x<to; x++)
+        red += image(y, x)[0];
+    return to > from ? red/(to - from) : 0;
+}
+
+// Where the wood ends, to a fraction of a pixel. 'edge' is the first
+// pixel (column or line, out of 'size') that isn't wood, 'inwards' the
+// direction of the tile area, and 'red' the profile across the edge: we
+// find where it crosses halfway from the wood ('reach' pixels out) to
+// the dark line around the tile area (within 'reach' pixels in), between
+// the two pixels on either side. (Resampled frames blend the pixels at
+// the edge - so deciding for each whether it's wood can be a pixel off,
+// and the tiles' size with it; the crossing moves with the scale only.)
+inline double edgeCrossing(unsigned edge, int inwards, unsigned size,
+                           unsigned reach,
+                           std::function<double(unsigned)> red)
+{
+    auto at = [&](long p) {
+        return unsigned(std::max(0L, std::min(long(size) - 1, p)));
+    };
+    double dark = red(edge);
+    for(unsigned k=1; k<reach; k++)
+        dark = std::min(dark, red(at(edge + long(k)*inwards)));
+    unsigned p = at(edge - long(reach)*inwards);
+    double half = (red(p) + dark)/2;
+    for(unsigned k=0; k<2*reach && red(at(p + inwards)) > half; k++)
+        p = at(p + inwards);
+    double before = red(p), after = red(at(p + inwards));
+    double fraction = before > after ? (before - half)/(before - after) : 0.5;
+    return p + 0.5 + inwards*fraction;
+}
+
+// Finds the board's tile area in 'image'. Returns false if there
+// doesn't seem to be a board in it.
+inline bool LocateBoard(const ImageView& image, BoardGeometry& geometry)
+{
+    unsigned width = image._width, height = image._height;
+    // The coarse level: about 80 samples across
+    unsigned step = width/80 > 1 ? width/80 : 1;
+
+    // 1. The tile area is the widest run of columns with little wood
+    unsigned runStart = 0, bestStart = 0, bestLength = 0;
+    for(unsigned x=0; x<=width; x+=step) {
+        bool low = x+step <= width &&
+            woodInColumn(image, x, 0, height, step) < 0.5;
+        if (!low) {
+            if (x - runStart > bestLength) {
+                bestLength = x - runStart;
+                bestStart = runStart;
+            }
+            runStart = x + step;
+        }
+    }
+    if (bestLength < width/3)
+        return false;
+    unsigned left = bestStart, right = bestStart + bestLength - step;
+
+    // 2. The board is square, so the tile area spans as many lines as
+    // columns. Slide a window that tall over the lines, and keep the
+    // spot where it covers the most non-wood lines (and the fewest
+    // wood ones - the frame's top and bottom edges).
+    unsigned side = right - left + step;
+    if (side >= height)
+        return false;
+    std::vector<double> score(height/step + 1, 0);
+    for(unsigned k=0; k*step<height; k++)
+        score[k] = 1 - 2*woodInLine(image, k*step, left, right+1, step);
+    unsigned window = side/step;
+    double sum = 0, bestSum = -1e9;
+    unsigned top = 0;
+    for(unsigned k=0; k*step<height; k++) {
+        sum += score[k];
+        if (k >= window)
+            sum -= score[k-window];
+        if (k+1 >= window && sum > bestSum) {
+            bestSum = sum;
+            top = (k+1-window)*step;
+        }
+    }
+
+    // 3. Refine the edges at full resolution, looking only around the
+    // coarse ones - and only at the board's lines (or columns). The
+    // coarse edges may be a step off in either direction: if a coarse
+    // edge is still inside the tile area, walk outwards until we hit
+    // the wood; otherwise walk inwards until we leave it.
+    auto refine = [step](unsigned pos, int outwards, unsigned limit,
+                         std::function<bool(unsigned)> isWoody) {
+        if (!isWoody(pos)) {
+            while (pos != limit && !isWoody(pos + outwards))
+                pos += outwards;
+        } else {
+            for(unsigned k=0; k<2*step && isWoody(pos); k++)
+                pos -= outwards;
+        }
+        return pos;
+    };
+    // (the coarse window may be off by a step - so the lines we look
+    // at here stop short of its ends)
+    unsigned first = top + 2*step, last = std::min(height, top + side);
+    last = last > 2*step ? last - 2*step : 0;
+    if (first >= last)
+        return false;
+    auto columnIsWoody = [&](unsigned x) {
+        return woodInColumn(image, x, first, last, 1) >= 0.5;
+    };
+    left = refine(left, -1, 0, columnIsWoody);
+    right = refine(right, 1, width-1, columnIsWoody);
+    side = right - left + 1;
+    if (side < width/3 || side >= height)
+        return false;
+
+    // Same for the top and bottom edges - which we only check: the
+    // tile area is not quite square (the snapshots have two lines more
+    // than columns of it).
+    auto lineIsWoody = [&](unsigned y) {
+        return woodInLine(image, y, left, right+1, 1) >= 0.5;
+    };
+    unsigned upper = refine(top, -1, 0, lineIsWoody);
+    unsigned lower = refine(std::min(height-1, top + side - 1), 1,
+                            height-1, lineIsWoody);
+    if (lower + 1 < upper + side)
+        return false;
+
+    // 4. The size of the tiles, and where they start, from where the
+    // wood ends on either side of the tile area, and above it. In the
+    // snapshots, that's at columns 9.915 and 310.13 (not quite on the
+    // pixels' edges, as the wood is antialiased), and line 119.903.
+    // (The dark line is two pixels of the snapshots wide - we look a
+    // bit further than that, at this scale.)
+    unsigned reach = std::max(3u, side/100);
+    auto redOfColumn = [&](unsigned x) {
+        return redInColumn(image, x, first, last);
+    };
+    auto redOfLine = [&](unsigned y) {
+        return redInLine(image, y, left, right+1);
+    };
+    double leftEdge = edgeCrossing(left, 1, width, reach, redOfColumn);
+    double rightEdge = edgeCrossing(right, -1, width, reach, redOfColumn);
+    double topEdge = edgeCrossing(upper, 1, height, reach, redOfLine);
+    double scale = (rightEdge - leftEdge)/(310.13 - 9.915);
+
+    geometry._top = topEdge + (121 - 119.903)*scale;
+    geometry._left = leftEdge + (10 - 9.915)*scale;
+    geometry._pitch = 50*scale;
+    return true;
+}
+
+#endif
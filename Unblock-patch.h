@@ -0,0 +1,144 @@
+// Averaging small patches of pixels, for the detectors.
+//
+// The detectors used to look at a single pixel per sampling point - and
+// one noisy pixel (a JPEG artifact, or a blend left by scaling) was
+// enough to misread a tile. Now they look at the average colour of a
+// small patch around each point instead: a few pixels along the line,
+// and - for the tile centers - a few lines as well. (Not for the
+// borders: their highlights are only a couple of lines tall.)
+//
+// That's 36*3 + 72 = 180 patch lines per frame, of PATCH_WIDTH = 5 RGB
+// pixels each. 15 bytes fit in one 128-bit load, so with AVX2 we add up
+// two patch lines per 256-bit register: a byte shuffle gathers the reds
+// and greens (and another the blues) of each line in separate 64-bit
+// lanes, and _mm256_sad_epu8 against zero sums each lane. On CPUs
+// without AVX2 (and on other architectures than x86), the same sums
+// are done with plain loops.
+
+#ifndef UNBLOCK_PATCH_H
+#define UNBLOCK_PATCH_H
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define PATCH_X86
+#include <immintrin.h>
+#endif
+
+#include <vector>
+
+#include "Unblock-frame.h"
+
+// How many pixels on each side of the sampled column a patch covers
+#define PATCH_RADIUS 2
+#define PATCH_WIDTH  (2*PATCH_RADIUS+1)
+
+// The R, G and B sums of each of 'count' patch lines - each given by
+// a pointer to its first pixel (packed RGB)
+inline void sumPatchLinesScalar(const unsigned char * const *starts,
+                                unsigned count, unsigned (*sums)[3])
+{
+    for(unsigned k=0; k<count; k++) {
+        sums[k][0] = sums[k][1] = sums[k][2] = 0;
+        for(int i=0; i<3*PATCH_WIDTH; i++)
+            sums[k][i%3] += starts[k][i];
+    }
+}
+
+// The same, two patch lines at a time. Each load starts one byte before
+// the patch (so that the 16 bytes don't run past its end), which is why
+// the shuffle indices start at 1 - and why callers must make sure that
+// no patch starts at the very first pixel of a line.
+#ifdef PATCH_X86
+__attribute__((target("avx2")))
+inline void sumPatchLinesAVX2(const unsigned char * const *starts,
+                              unsigned count, unsigned (*sums)[3])
+{
+    const __m256i redsAndGreens = _mm256_setr_epi8(
+        1, 4, 7, 10, 13, -1, -1, -1,   2, 5, 8, 11, 14, -1, -1, -1,
+        1, 4, 7, 10, 13, -1, -1, -1,   2, 5, 8, 11, 14, -1, -1, -1);
+    const __m256i blues = _mm256_setr_epi8(
+        3, 6, 9, 12, 15, -1, -1, -1,  -1, -1, -1, -1, -1, -1, -1, -1,
+        3, 6, 9, 12, 15, -1, -1, -1,  -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i zero = _mm256_setzero_si256();
+    for(unsigned k=0; k<count; k+=2) {
+        __m128i lo = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(starts[k] - 1));
+        __m128i hi = k+1 < count ? _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(starts[k+1] - 1)) : lo;
+        __m256i pixels = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(lo), hi, 1);
+        __m256i rg = _mm256_sad_epu8(
+            _mm256_shuffle_epi8(pixels, redsAndGreens), zero);
+        __m256i b = _mm256_sad_epu8(
+            _mm256_shuffle_epi8(pixels, blues), zero);
+        uint64_t rgSums[4], bSums[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgSums), rg);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(bSums), b);
+        sums[k][0] = unsigned(rgSums[0]);
+        sums[k][1] = unsigned(rgSums[1]);
+        sums[k][2] = unsigned(bSums[0]);
+        if (k+1 < count) {
+            sums[k+1][0] = unsigned(rgSums[2]);
+            sums[k+1][1] = unsigned(rgSums[3]);
+            sums[k+1][2] = unsigned(bSums[2]);
+        }
+    }
+}
+
+inline bool haveAVX2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+// The average colour of the patches centered at (lines[k], columns[k]),
+// each 'height' lines tall and PATCH_WIDTH pixels wide.
+inline void AveragePatches(const ImageView& image, const unsigned *lines,
+                           const unsigned *columns, unsigned count,
+                           unsigned height, unsigned char (*average)[3])
+{
+    std::vector<const unsigned char*> starts;
+    starts.reserve(count*height);
+    bool packed = image._pixelStride == 3;
+    for(unsigned k=0; k<count; k++)
+        for(unsigned i=0; i<height; i++) {
+            unsigned column = columns[k] - PATCH_RADIUS;
+            starts.push_back(image(lines[k] - height/2 + i, column));
+            // (the AVX2 loads start a byte early - see above)
+            packed = packed && column > 0;
+        }
+    std::vector<unsigned> sums(3*starts.size());
+    unsigned (*lineSums)[3] = reinterpret_cast<unsigned (*)[3]>(&sums[0]);
+#ifdef PATCH_X86
+    if (packed && haveAVX2())
+        sumPatchLinesAVX2(&starts[0], unsigned(starts.size()), lineSums);
+    else
+#endif
+    if (packed)
+        sumPatchLinesScalar(&starts[0], unsigned(starts.size()), lineSums);
+    else {
+        // Not packed RGB (RGBA, say): walk the pixels one by one
+        for(unsigned k=0; k<count; k++)
+            for(unsigned i=0; i<height; i++) {
+                unsigned *s = lineSums[k*height + i];
+                s[0] = s[1] = s[2] = 0;
+                for(int j=-PATCH_RADIUS; j<=PATCH_RADIUS; j++) {
+                    const unsigned char *pixel = image(
+                        lines[k] - height/2 + i, columns[k] + j);
+                    for(int c=0; c<3; c++)
+                        s[c] += pixel[c];
+                }
+            }
+    }
+    unsigned area = height*PATCH_WIDTH;
+    for(unsigned k=0; k<count; k++)
+        for(int c=0; c<3; c++) {
+            unsigned total = 0;
+            for(unsigned i=0; i<height; i++)
+                total += lineSums[k*height + i][c];
+            average[k][c] = (unsigned char)((total + area/2) / area);
+        }
+}
+
+#endif
@@ -0,0 +1,155 @@
+// Pattern database builder and checker (see Unblock-pdb.h).
+//
+// For every board it is given (read from stdin, in the corpus format of
+// Unblock-generate) it builds the pattern database - or maps one from a
+// file - and checks it: against the exact distances of all the boards
+// reachable from the starting one (found by ReverseBFS), the estimates
+// must never be too high. It then solves the board with A* (and with -i,
+// IDA* too, which can take long) guided by the database, and compares
+// with a plain BFS:
+//
+//     ZZ.A..B..A..BCCD..E..D..E...FF.GGG.. moves=14 pattern=8
+//       entries=41230 build-usec=5230 checked=1523 too-high=0
+//       estimate=0.71 astar=14/212 ida=14/518 bfs=3102
+//
+// (all on one line, with -i). "estimate" is the average ratio of the
+// estimate to the exact distance; after "astar" and "ida" come the moves
+// found and the boards expanded.
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_set>
+
+#include "Unblock-engine.h"
+#include "Unblock-pdb.h"
+
+using namespace std;
+
+void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " [options] < boards.txt\n\n";
+    cerr << "  -k blocks   the most blocks in a pattern (default: 8)\n";
+    cerr << "  -o file     save the database of the (single) board\n";
+    cerr << "  -m file     map the database in this file, instead of\n";
+    cerr << "              building one\n";
+    cerr << "  -i          solve with IDA* too\n";
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int maxBlocks = 8;
+    bool withIDA = false;
+    string output, input;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:o:m:i")) != -1) {
+        switch (opt) {
+        case 'k':
+            maxBlocks = atoi(optarg);
+            if (maxBlocks < 1 || maxBlocks > MAXBLOCKS)
+                usage(argv[0]);
+            break;
+        case 'o': output = optarg; break;
+        case 'm': input = optarg; break;
+        case 'i': withIDA = true; break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    string line;
+    int boards = 0, result = 0;
+    while (getline(cin, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        string board = line.substr(0, line.find(' '));
+        Puzzle puzzle;
+        State start;
+        string error;
+        if (!parseBoard(board, puzzle, start, error)) {
+            cerr << board << ": " << error << "\n";
+            result = 1;
+            continue;
+        }
+        if (++boards > 1 && !output.empty()) {
+            cerr << "-o needs a single board\n";
+            return 1;
+        }
+
+        PatternDatabase pdb;
+        auto begin = chrono::steady_clock::now();
+        if (input.empty())
+            pdb.build(puzzle, start,
+                PatternDatabase::choosePattern(puzzle, start, maxBlocks));
+        else if (!pdb.load(input, error) ||
+                 !pdb.attach(puzzle, start, error)) {
+            cerr << board << ": " << error << "\n";
+            result = 1;
+            continue;
+        }
+        auto usec = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - begin).count();
+        if (!output.empty() && !pdb.save(output, error)) {
+            cerr << error << "\n";
+            return 1;
+        }
+
+        // The exact distances, for every board reachable from 'start'
+        GoalDistances distances;
+        ReverseBFS(puzzle, distances);
+        unordered_set<State> reached;
+        vector<State> frontier(1, start), next;
+        reached.insert(start);
+        size_t checked = 0, tooHigh = 0;
+        double ratios = 0;
+        while (!frontier.empty()) {
+            next.clear();
+            for(auto s: frontier) {
+                int exact = distances.depth(s), h = pdb.estimate(s);
+                if (exact >= 0) {
+                    checked++;
+                    if (h < 0 || h > exact)
+                        tooHigh++;
+                    else if (exact)
+                        ratios += double(h)/exact;
+                    else
+                        ratios += 1;
+                }
+                puzzle.forEachMove(s, [&](State n, int, int) {
+                    if (reached.insert(n).second)
+                        next.push_back(n);
+                });
+            }
+            frontier.swap(next);
+        }
+
+        auto estimate = [&](State s) {
+            int h = pdb.estimate(s);
+            return h < 0 ? -1 : max(h, exitLaneBlocks(puzzle, s));
+        };
+        size_t astarExpanded, idaExpanded = 0, bfsExpanded;
+        int depth = SolveDepth(puzzle, start, &bfsExpanded);
+        int astar = SolveAStar(puzzle, start, estimate, NULL, &astarExpanded);
+        int ida = withIDA ?
+            SolveIDA(puzzle, start, true, NULL, &idaExpanded, estimate,
+                     16 << 20) :
+            depth;
+
+        cout << board << " moves=" << depth << " pattern=" << pdb.blocks();
+        cout << " entries=" << pdb.size() << " build-usec=" << usec;
+        cout << " checked=" << checked << " too-high=" << tooHigh;
+        cout << " estimate=" << (checked ? ratios/checked : 0);
+        cout << " astar=" << astar << "/" << astarExpanded;
+        if (withIDA)
+            cout << " ida=" << ida << "/" << idaExpanded;
+        cout << " bfs=" << bfsExpanded << "\n";
+        if (tooHigh || astar != depth || ida != depth)
+            result = 1;
+    }
+    return result;
+}
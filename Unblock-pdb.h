@@ -0,0 +1,357 @@
+// Pattern databases: exact distances over a few blocks, as a heuristic.
+//
+// Leave out all the blocks of a board but a few - the "pattern" - and
+// what's left is an easier puzzle: the blocks left out are no longer in
+// the way. Its optimal number of moves from any board is thus a lower
+// bound for the real puzzle (every real solution, minus the moves of
+// the blocks left out, solves it too) - a heuristic that A* and IDA*
+// can use, far better informed than counting the blocks in the
+// prisoner's way.
+//
+// The pattern is the prisoner, the blocks in its way, the blocks in
+// *their* way, and so on - up to a maximum number of blocks. Its boards
+// are few enough to number them densely with a StateRanker, and to
+// find the distance of every one of them from the goals with a
+// backward BFS. The table is just a byte per rank.
+//
+// Building a table is a search of its own - so tables can be saved to a
+// file, and mapped back in: a fixed-size header describing the pattern,
+// followed by the table as is. Only the pages that lookups touch are
+// ever read.
+
+#ifndef UNBLOCK_PDB_H
+#define UNBLOCK_PDB_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Unblock-engine.h"
+
+// Table entries for boards of the pattern that have no solution
+#define PDB_UNSOLVABLE 255
+
+// What's at the start of a database file. The blocks are listed as
+// they were when the table was built: y, x, isHorizontal, length and
+// isPrisoner. (Files are meant for the machine that made them: the
+// header is written as is, in native byte order.)
+struct PatternFileHeader {
+    char _magic[8];                     // "UNBLKPDB"
+    uint32_t _version;
+    uint32_t _count;
+    int8_t _blocks[MAXBLOCKS][5];
+    uint64_t _entries;
+};
+
+class PatternDatabase {
+public:
+    PatternDatabase(): _table(NULL), _size(0), _mapped(NULL),
+        _mappedSize(0) {}
+    ~PatternDatabase() { unmap(); }
+
+    // The blocks of the pattern for 'puzzle' at 'start': the prisoner,
+    // then the blocks covering the tiles it must clear, then those
+    // covering the tiles these can reach, etc - a layer at a time, for
+    // as long as there is room for at most 'maxBlocks' blocks.
+    static std::vector<int> choosePattern(const Puzzle& puzzle, State start,
+                                          int maxBlocks)
+    {
+        BlockAnalysis analysis(puzzle, start);
+        std::vector<int> pattern(1, puzzle._prisoner);
+        std::vector<bool> taken(puzzle._count, false);
+        taken[puzzle._prisoner] = true;
+        int prisoner = puzzle._prisoner;
+        Cells needed = 0;
+        int lane = puzzle._lane[prisoner];
+        for(int x=Puzzle::get(start, prisoner)+puzzle._length[prisoner];
+                x<SIZE; x++)
+            needed |= tileBit(lane, x);
+        while (int(pattern.size()) < maxBlocks) {
+            Cells next = 0;
+            size_t before = pattern.size();
+            for(int i=0; i<puzzle._count; i++)
+                if (!taken[i] && int(pattern.size()) < maxBlocks &&
+                        (puzzle._masks[i][Puzzle::get(start, i)] & needed)) {
+                    taken[i] = true;
+                    pattern.push_back(i);
+                    next |= analysis._reach[i];
+                }
+            if (pattern.size() == before)
+                break;
+            needed = next;
+        }
+        return pattern;
+    }
+
+    // Builds the table for the 'pattern' blocks of 'puzzle', and
+    // attaches it to 'puzzle'. Returns the size of the table - or 0,
+    // leaving the database empty, if it would take more than 'maxBytes'
+    // (with its ranker; the levels of the search come on top).
+    size_t build(const Puzzle& puzzle, State start,
+                 const std::vector<int>& pattern, size_t maxBytes = 0)
+    {
+        unmap();
+        _pattern = Puzzle();
+        _patternStart = 0;
+        for(size_t k=0; k<pattern.size(); k++) {
+            int i = pattern[k];
+            _pattern.addBlock(puzzle.y(start, i), puzzle.x(start, i),
+                              puzzle._isHorizontal[i], puzzle._length[i],
+                              i == puzzle._prisoner, _patternStart);
+        }
+        // (a byte for the table and 4 for the ranker, per rank)
+        _ranker.reset(new StateRanker(_pattern, _patternStart,
+            maxBytes ? maxBytes/(1 + sizeof(uint32_t)) + 1 : 0));
+        if (maxBytes && _ranker->size() + _ranker->bytes() > maxBytes) {
+            _ranker.reset();
+            return 0;
+        }
+        _built.assign(_ranker->size(), PDB_UNSOLVABLE);
+        _table = _built.empty() ? NULL : &_built[0];
+        _size = _built.size();
+        _blocks = pattern;
+
+        // Backward BFS, from all the goal boards at once
+        std::vector<State> frontier, next;
+        for(uint64_t r=0; r<_size; r++) {
+            State s = _ranker->unrank(r);
+            if (_pattern.isGoal(s)) {
+                _built[r] = 0;
+                frontier.push_back(s);
+            }
+        }
+        for(int depth=1; !frontier.empty(); depth++) {
+            next.clear();
+            unsigned char d = (unsigned char)
+                std::min(depth, PDB_UNSOLVABLE-1);
+            for(size_t k=0; k<frontier.size(); k++)
+                _pattern.forEachMove(frontier[k], [&](State n, int, int) {
+                    unsigned char& entry = _built[_ranker->rank(n)];
+                    if (entry == PDB_UNSOLVABLE) {
+                        entry = d;
+                        next.push_back(n);
+                    }
+                });
+            frontier.swap(next);
+        }
+        return _size;
+    }
+
+    // Writes the table to 'path'. On failure, returns false and
+    // explains why in 'error'.
+    bool save(const std::string& path, std::string& error) const
+    {
+        PatternFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header._magic, "UNBLKPDB", 8);
+        header._version = 1;
+        header._count = _pattern._count;
+        for(int k=0; k<_pattern._count; k++) {
+            int8_t *b = header._blocks[k];
+            b[0] = int8_t(_pattern.y(_patternStart, k));
+            b[1] = int8_t(_pattern.x(_patternStart, k));
+            b[2] = _pattern._isHorizontal[k];
+            b[3] = int8_t(_pattern._length[k]);
+            b[4] = k == _pattern._prisoner;
+        }
+        header._entries = _size;
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (!fp) {
+            error = "cannot create '" + path + "'";
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            (!_size || fwrite(_table, 1, _size, fp) == _size);
+        ok = fclose(fp) == 0 && ok;
+        if (!ok)
+            error = "failed to write '" + path + "'";
+        return ok;
+    }
+
+    // Maps the table in 'path' (see attach). On failure, returns false
+    // and explains why in 'error'.
+    bool load(const std::string& path, std::string& error)
+    {
+        unmap();
+        _built.clear();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open '" + path + "'";
+            return false;
+        }
+        struct stat st;
+        PatternFileHeader header;
+        bool ok = fstat(fd, &st) == 0 &&
+            size_t(st.st_size) >= sizeof(header) &&
+            pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            !memcmp(header._magic, "UNBLKPDB", 8) && header._version == 1 &&
+            header._count >= 1 && header._count <= MAXBLOCKS &&
+            isBoard(header) &&
+            size_t(st.st_size) == sizeof(header) + header._entries;
+        if (ok) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = p != MAP_FAILED;
+            if (ok) {
+                // Lookups are all over the table
+                madvise(p, st.st_size, MADV_RANDOM);
+                _mapped = p;
+                _mappedSize = st.st_size;
+            }
+        }
+        ::close(fd);
+        if (!ok) {
+            error = "'" + path + "' is not a pattern database";
+            return false;
+        }
+        _pattern = Puzzle();
+        _patternStart = 0;
+        for(uint32_t k=0; k<header._count; k++) {
+            const int8_t *b = header._blocks[k];
+            _pattern.addBlock(b[0], b[1], b[2] != 0, b[3], b[4] != 0,
+                              _patternStart);
+        }
+        _ranker.reset(new StateRanker(_pattern, _patternStart));
+        if (_ranker->size() != header._entries) {
+            unmap();
+            error = "'" + path + "' doesn't match its pattern";
+            return false;
+        }
+        _table = static_cast<const unsigned char*>(_mapped) + sizeof(header);
+        _size = header._entries;
+        _blocks.clear();
+        return true;
+    }
+
+    // Ties a loaded table to the blocks of 'puzzle': each block of the
+    // pattern goes to a block of the same orientation, lane, length and
+    // kind - the first one of them along the lane to the first, and so
+    // on. The blocks of each lane must come in the same order as in the
+    // pattern, too. On failure, returns false and explains why.
+    bool attach(const Puzzle& puzzle, State start, std::string& error)
+    {
+        _blocks.assign(_pattern._count, -1);
+        std::vector<bool> used(puzzle._count, false);
+        for(int k=0; k<_pattern._count; k++) {
+            // The k-th block is the how-many-th of its kind on its lane?
+            int rank = 0;
+            for(int j=0; j<_pattern._count; j++)
+                rank += sameKind(_pattern, j, _pattern, k) &&
+                    Puzzle::get(_patternStart, j) <
+                        Puzzle::get(_patternStart, k);
+            std::vector<std::pair<int, int> > candidates;
+            for(int i=0; i<puzzle._count; i++)
+                if (sameKind(puzzle, i, _pattern, k))
+                    candidates.push_back(
+                        std::make_pair(Puzzle::get(start, i), i));
+            std::sort(candidates.begin(), candidates.end());
+            if (rank >= int(candidates.size()) ||
+                    used[candidates[rank].second]) {
+                error = "the board lacks blocks of the pattern";
+                return false;
+            }
+            _blocks[k] = candidates[rank].second;
+            used[_blocks[k]] = true;
+        }
+        State projected = project(start);
+        if (!_pattern.isLegal(projected) ||
+                _ranker->unrank(_ranker->rank(projected)) != projected) {
+            error = "the board's blocks are in another order";
+            return false;
+        }
+        return true;
+    }
+
+    // The pattern's board for a board of the attached puzzle
+    State project(State s) const {
+        State p = 0;
+        for(size_t k=0; k<_blocks.size(); k++)
+            p = Puzzle::set(p, int(k), Puzzle::get(s, _blocks[k]));
+        return p;
+    }
+
+    // A lower bound on the moves needed from 's' - or -1 if it has
+    // no solution
+    int estimate(State s) const {
+        if (!_size)
+            return 0;
+        unsigned char d = _table[_ranker->rank(project(s))];
+        return d == PDB_UNSOLVABLE ? -1 : d;
+    }
+
+    size_t size() const { return _size; }
+    int blocks() const { return _pattern._count; }
+    // What the table and its ranker take
+    size_t bytes() const {
+        return _size + (_ranker ? _ranker->bytes() : 0);
+    }
+    int maxDepth() const {
+        int m = 0;
+        for(size_t r=0; r<_size; r++)
+            if (_table[r] != PDB_UNSOLVABLE)
+                m = std::max(m, int(_table[r]));
+        return m;
+    }
+
+private:
+    PatternDatabase(const PatternDatabase&);
+    PatternDatabase& operator=(const PatternDatabase&);
+
+    // Whether the blocks of 'header' make a board: each 2 or 3 tiles
+    // long and all on it, none overlapping another, and one of them -
+    // lying horizontally - the prisoner
+    static bool isBoard(const PatternFileHeader& header) {
+        Cells occupied = 0;
+        int prisoners = 0;
+        for(uint32_t k=0; k<header._count; k++) {
+            const int8_t *b = header._blocks[k];
+            int y = b[0], x = b[1], length = b[3];
+            if ((length != 2 && length != 3) || b[2] < 0 || b[2] > 1 ||
+                    b[4] < 0 || b[4] > 1 || (b[4] && !b[2]) ||
+                    y < 0 || x < 0 || (b[2] ? y : y+length-1) >= SIZE ||
+                    (b[2] ? x+length-1 : x) >= SIZE)
+                return false;
+            for(int t=0; t<length; t++) {
+                Cells tile = b[2] ? tileBit(y, x+t) : tileBit(y+t, x);
+                if (occupied & tile)
+                    return false;
+                occupied |= tile;
+            }
+            prisoners += b[4];
+        }
+        return prisoners == 1;
+    }
+
+    static bool sameKind(const Puzzle& a, int i, const Puzzle& b, int j) {
+        return a._isHorizontal[i] == b._isHorizontal[j] &&
+            a._lane[i] == b._lane[j] && a._length[i] == b._length[j] &&
+            (i == a._prisoner) == (j == b._prisoner);
+    }
+
+    void unmap() {
+        if (_mapped)
+            munmap(_mapped, _mappedSize);
+        _mapped = NULL;
+        _mappedSize = 0;
+        _table = NULL;
+        _size = 0;
+    }
+
+    Puzzle _pattern;
+    State _patternStart;
+    std::unique_ptr<StateRanker> _ranker;
+    std::vector<int> _blocks;           // the puzzle's index of each
+    std::vector<unsigned char> _built;  // the table, when built here...
+    const unsigned char *_table;        // ...or mapped from a file
+    size_t _size;
+    void *_mapped;
+    size_t _mappedSize;
+};
+
+#endif
@@ -0,0 +1,172 @@
+// Hardware performance counters, for the benchmarks.
+//
+// Wall-clock time tells us *that* a solve is slow - the counters
+// tell us *why*: e.g. whether the search is bound by cache misses in
+// its visited set. The counters are read with Linux's perf_event_open
+// around each solve - and count the threads a solve starts too (as
+// long as they are joined before the solve is over).
+//
+// Not every machine gives us these counters (VMs and containers often
+// don't, and kernel.perf_event_paranoid may forbid them) - so each
+// counter that fails to open is reported as missing, and if none of
+// the hardware ones work, we fall back to what the kernel can count
+// in software (task clock, page faults) - or, if even that fails,
+// to getrusage for the page faults. Elsewhere than on Linux, that is
+// all there is.
+
+#ifndef UNBLOCK_PERF_H
+#define UNBLOCK_PERF_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <cstring>
+
+class PerfCounters {
+public:
+    enum Event {
+        cycles, instructions, l1dMisses, llcMisses, branchMisses,
+        dtlbMisses,
+        // the software events, used when the above are not there
+        taskClock, pageFaults,
+        EVENTS
+    };
+
+    PerfCounters(): _hardware(false), _seconds(0) {
+        memset(_values, 0, sizeof(_values));
+        for(int e=0; e<EVENTS; e++) {
+            _fds[e] = -1;
+            _valid[e] = false;
+        }
+#ifdef __linux__
+        static const struct {
+            uint32_t type;
+            uint64_t config;
+        } events[] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D) },
+            { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_LL) },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB) },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+            { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+        };
+        for(int e=0; e<EVENTS; e++) {
+            _fds[e] = open(events[e].type, events[e].config);
+            if (_fds[e] >= 0 && e < taskClock)
+                _hardware = true;
+        }
+#endif
+    }
+    ~PerfCounters() {
+        for(int e=0; e<EVENTS; e++)
+            if (_fds[e] >= 0)
+                close(_fds[e]);
+    }
+
+    void start() {
+#ifdef __linux__
+        for(int e=0; e<EVENTS; e++)
+            if (_fds[e] >= 0) {
+                ioctl(_fds[e], PERF_EVENT_IOC_RESET, 0);
+                ioctl(_fds[e], PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &_startTime);
+        getrusage(RUSAGE_SELF, &_startUsage);
+    }
+
+    void stop() {
+        timespec endTime;
+        rusage endUsage;
+        clock_gettime(CLOCK_MONOTONIC, &endTime);
+        getrusage(RUSAGE_SELF, &endUsage);
+        for(int e=0; e<EVENTS; e++) {
+            _valid[e] = false;
+#ifdef __linux__
+            if (_fds[e] < 0)
+                continue;
+            ioctl(_fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            // If the PMU was shared with other events, the kernel only
+            // counted part of the time - scale up accordingly.
+            uint64_t data[3]; // value, time enabled, time running
+            if (read(_fds[e], data, sizeof(data)) != sizeof(data) ||
+                    data[2] == 0)
+                continue;
+            _values[e] = data[1] == data[2] ? data[0] :
+                uint64_t(double(data[0]) * data[1] / data[2]);
+            _valid[e] = true;
+#endif
+        }
+        _seconds = (endTime.tv_sec - _startTime.tv_sec) +
+            (endTime.tv_nsec - _startTime.tv_nsec) * 1e-9;
+        // The last resort, when the kernel won't count for us at all
+        // (there's none for the task clock: wall-clock time is not the
+        // same thing, and seconds() has it anyway)
+        if (!_valid[pageFaults]) {
+            _values[pageFaults] =
+                (endUsage.ru_minflt - _startUsage.ru_minflt) +
+                (endUsage.ru_majflt - _startUsage.ru_majflt);
+            _valid[pageFaults] = true;
+        }
+    }
+
+    // Whether at least one hardware counter could be opened
+    bool hasHardware() const { return _hardware; }
+
+    bool valid(Event e) const { return _valid[e]; }
+    uint64_t value(Event e) const { return _values[e]; }
+    double seconds() const { return _seconds; }
+
+    static const char *name(Event e) {
+        static const char *names[EVENTS] = {
+            "cycles", "instructions", "L1d-misses", "LLC-misses",
+            "branch-misses", "dTLB-misses", "task-clock-ns", "page-faults"
+        };
+        return names[e];
+    }
+
+private:
+#ifdef __linux__
+    static uint64_t cacheEvent(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    // Opens one counter, for this thread and those it starts from then
+    // on (e.g. the workers of the threaded searches), counting user
+    // space only. Counts of a thread are added in when it exits.
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+
+    int _fds[EVENTS];
+    bool _valid[EVENTS];
+    uint64_t _values[EVENTS];
+    bool _hardware;
+    double _seconds;
+    timespec _startTime;
+    rusage _startUsage;
+};
+
+#endif
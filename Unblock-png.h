@@ -0,0 +1,285 @@
+// A minimal PNG reader, so we don't need to shell out to ImageMagick's
+// "convert" before every run.
+//
+// Detection only samples a handful of lines of each frame, so this
+// reader only reconstructs those: the caller passes the lines it
+// needs, and the reader...
+//
+//  - stops inflating the compressed stream right after the last of
+//    them (the rest of the file is not even read), and
+//  - only "unfilters" the lines it must. PNG lines are stored filtered,
+//    and the Up, Average and Paeth filters refer to the line above -
+//    so reconstructing a needed line may require the ones above it.
+//    But a None or Sub line stands on its own, so we keep the filtered
+//    lines pending, and only reconstruct the chain back to the nearest
+//    self-contained one (or to the last line we already reconstructed).
+//
+// Only what the iPhone snapshots use is supported: 8-bit RGB or RGBA,
+// non-interlaced.
+
+#ifndef UNBLOCK_PNG_H
+#define UNBLOCK_PNG_H
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Unblock-frame.h"
+
+class PngFrame {
+public:
+    PngFrame(): _width(0), _height(0), _bpp(0) {}
+
+    // Given the width and height of the image, returns the lines
+    // that must be decoded - or nothing, to decode them all.
+    typedef std::function<std::vector<unsigned>(unsigned, unsigned)>
+        LineSelector;
+
+    // Decodes the PNG in 'path' - only the lines picked by 'linesFor'.
+    // The pixels of other lines are left undefined. On failure,
+    // returns false and explains why in 'error'.
+    bool open(const std::string& path, LineSelector linesFor,
+              std::string& error)
+    {
+        FILE *fp = fopen(path.c_str(), "rb");
+        if (!fp) {
+            error = "cannot open '" + path + "'";
+            return false;
+        }
+        bool ok = decode(fp, linesFor, error);
+        fclose(fp);
+        if (!ok)
+            error = "'" + path + "': " + error;
+        return ok;
+    }
+
+    const ImageView& view() const { return _view; }
+    unsigned width() const { return _width; }
+    unsigned height() const { return _height; }
+
+    // How many lines we had to unfilter (for the curious)
+    unsigned unfiltered() const { return _unfiltered; }
+
+private:
+    static uint32_t be32(const unsigned char *p) {
+        return (uint32_t(p[0])<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+    }
+
+    static unsigned char paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        if (pb <= pc) return b;
+        return c;
+    }
+
+    // Reconstructs a line in place, given the (reconstructed) line above
+    void unfilter(unsigned char *cur, const unsigned char *prev, int filter)
+    {
+        size_t n = _stride;
+        unsigned bpp = _bpp;
+        _unfiltered++;
+        switch (filter) {
+        case 0: // None
+            break;
+        case 1: // Sub
+            for(size_t i=bpp; i<n; i++)
+                cur[i] += cur[i-bpp];
+            break;
+        case 2: // Up
+            for(size_t i=0; i<n; i++)
+                cur[i] += prev[i];
+            break;
+        case 3: // Average
+            for(size_t i=0; i<n; i++)
+                cur[i] += ((i>=bpp ? cur[i-bpp] : 0) + prev[i]) >> 1;
+            break;
+        case 4: // Paeth
+            for(size_t i=0; i<n; i++)
+                cur[i] += i>=bpp ?
+                    paeth(cur[i-bpp], prev[i], prev[i-bpp]) :
+                    paeth(0, prev[i], 0);
+            break;
+        }
+    }
+
+    // Called for every line as soon as it is inflated
+    bool onLine(unsigned line, const unsigned char *filtered)
+    {
+        int filter = filtered[0];
+        if (filter > 4)
+            return false;
+        // A None or Sub line doesn't need what came before it
+        if (filter <= 1)
+            _pending.clear();
+        _pending.push_back(std::vector<unsigned char>(
+            filtered, filtered + 1 + _stride));
+        if (!_needed[line])
+            return true;
+
+        // Reconstruct the pending chain, from its oldest line down to
+        // this one. The oldest line is either self-contained, or the
+        // one right after the last line we reconstructed (_previous),
+        // or the very first line of the image.
+        unsigned first = line + 1 - unsigned(_pending.size());
+        bool havePrevious = _havePrevious && _previousLine + 1 == first;
+        for(size_t k=0; k<_pending.size(); k++) {
+            unsigned char *cur = &_pending[k][1];
+            const unsigned char *prev = k ? &_pending[k-1][1] :
+                havePrevious ? &_previous[0] : &_zeroes[0];
+            unfilter(cur, prev, _pending[k][0]);
+        }
+        const unsigned char *done = &_pending.back()[1];
+        memcpy(&_pixels[size_t(line)*_stride], done, _stride);
+        _previous.assign(_pending.back().begin()+1, _pending.back().end());
+        _previousLine = line;
+        _havePrevious = true;
+        _pending.clear();
+        return true;
+    }
+
+    bool decode(FILE *fp, LineSelector linesFor, std::string& error)
+    {
+        static const unsigned char signature[8] =
+            { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        unsigned char header[8];
+        if (fread(header, 1, 8, fp) != 8 || memcmp(header, signature, 8)) {
+            error = "not a PNG file";
+            return false;
+        }
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        bool haveHeader = false, ok = false, zsInit = false;
+        unsigned lastNeeded = 0, line = 0;
+        std::vector<unsigned char> chunk, scanline;
+        size_t scanlineFill = 0;
+        _unfiltered = 0;
+
+        while (fread(header, 1, 8, fp) == 8) {
+            uint32_t length = be32(header);
+            std::string type(reinterpret_cast<char*>(header+4), 4);
+            // (the PNG spec caps chunks at 2^31-1 bytes)
+            if (length > 0x7FFFFFFFu) {
+                error = "corrupt chunk length";
+                break;
+            }
+            // Data, plus the CRC - which we don't check; zlib's
+            // own checksum is also skipped, since we stop early.
+            size_t chunkSize = size_t(length) + 4;
+            chunk.resize(chunkSize);
+            if (fread(&chunk[0], 1, chunkSize, fp) != chunkSize) {
+                error = "truncated file";
+                break;
+            }
+            if (type == "IHDR") {
+                if (haveHeader) {
+                    error = "repeated header";
+                    break;
+                }
+                if (length < 13) {
+                    error = "bad header";
+                    break;
+                }
+                _width = be32(&chunk[0]);
+                _height = be32(&chunk[4]);
+                int depth = chunk[8], color = chunk[9];
+                int interlace = chunk[12];
+                if (depth != 8 || (color != 2 && color != 6) || interlace) {
+                    error = "only 8-bit, non-interlaced RGB(A) is supported";
+                    break;
+                }
+                if (!_width || !_height ||
+                        _width > 16384 || _height > 16384) {
+                    error = "bad dimensions";
+                    break;
+                }
+                _bpp = color == 6 ? 4 : 3;
+                _stride = size_t(_width) * _bpp;
+                std::vector<unsigned> lines = linesFor(_width, _height);
+                _needed.assign(_height, lines.empty());
+                lastNeeded = lines.empty() ? _height-1 : 0;
+                for(size_t k=0; k<lines.size(); k++)
+                    if (lines[k] < _height) {
+                        _needed[lines[k]] = true;
+                        lastNeeded = std::max(lastNeeded, lines[k]);
+                    }
+                // Not zero-filled: only the lines we decode are touched
+                _pixels.reset(new unsigned char[_stride * _height]);
+                _zeroes.assign(_stride, 0);
+                _pending.clear();
+                _havePrevious = false;
+                scanline.resize(1 + _stride);
+                if (inflateInit(&zs) != Z_OK) {
+                    error = "zlib failure";
+                    break;
+                }
+                zsInit = true;
+                haveHeader = true;
+            } else if (type == "IDAT") {
+                if (!haveHeader) {
+                    error = "image data before the header";
+                    break;
+                }
+                zs.next_in = &chunk[0];
+                zs.avail_in = length;
+                int rc = Z_OK;
+                while (line <= lastNeeded) {
+                    zs.next_out = &scanline[scanlineFill];
+                    zs.avail_out = unsigned(scanline.size() - scanlineFill);
+                    rc = inflate(&zs, Z_NO_FLUSH);
+                    scanlineFill = scanline.size() - zs.avail_out;
+                    if (scanlineFill == scanline.size()) {
+                        if (!onLine(line++, &scanline[0])) {
+                            rc = Z_DATA_ERROR;
+                            break;
+                        }
+                        scanlineFill = 0;
+                    } else if (rc != Z_OK || !zs.avail_in)
+                        break; // we need the next chunk
+                }
+                if (rc != Z_OK && rc != Z_STREAM_END &&
+                        rc != Z_BUF_ERROR) {
+                    error = "corrupt image data";
+                    break;
+                }
+                if (line > lastNeeded) {
+                    // All the lines we need are there - stop reading.
+                    ok = true;
+                    break;
+                }
+            } else if (type == "IEND") {
+                error = "image data ends too early";
+                break;
+            }
+        }
+        if (zsInit)
+            inflateEnd(&zs);
+        if (ok)
+            _view = ImageView(_pixels.get(), _width, _height, _stride, _bpp);
+        else if (error.empty())
+            error = "truncated file";
+        return ok;
+    }
+
+    unsigned _width, _height, _bpp;
+    size_t _stride;
+    std::unique_ptr<unsigned char[]> _pixels;
+    std::vector<bool> _needed;
+    std::vector<std::vector<unsigned char> > _pending;
+    std::vector<unsigned char> _previous, _zeroes;
+    unsigned _previousLine;
+    bool _havePrevious;
+    unsigned _unfiltered;
+    ImageView _view;
+};
+
+#endif
@@ -0,0 +1,88 @@
+// Resampler of the iPhone snapshots, for testing the board locator.
+//
+// Other phones don't give us the 320x480 frames the detectors were
+// written against: the game is drawn at their resolution, and a
+// screenshot (or a video frame) may have been scaled again on its way
+// to us. This makes such frames out of the snapshots we have: it
+// scales a snapshot to the width asked for, bilinearly (as scalers
+// usually do), keeping its aspect ratio - and if that leaves lines to
+// fill, repeats the first and last ones, like the longer backgrounds
+// of taller screens. The result goes to stdout, as raw RGB:
+//
+//     bash$ ./Unblock-resample IMG_0354.PNG 640x1136 > frame.rgb
+//     bash$ ./Unblock-solve-c++11 -g 640x1136 frame.rgb
+//
+// "make test-scaled" does this for all snapshots, at a few resolutions,
+// and checks that the boards found are those of the snapshots.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "Unblock-png.h"
+
+using namespace std;
+
+void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " snapshot.png WxH > frame.rgb\n";
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned width, height;
+    if (argc != 3 || 2 != sscanf(argv[2], "%ux%u", &width, &height) ||
+            !width || !height)
+        usage(argv[0]);
+
+    PngFrame png;
+    string error;
+    if (!png.open(argv[1], [](unsigned, unsigned) {
+                      return vector<unsigned>();
+                  }, error)) {
+        cerr << error << "\n";
+        return 1;
+    }
+    const ImageView& image = png.view();
+
+    // Pixel centers map to pixel centers; the scaled snapshot is
+    // centered vertically in the frame.
+    double scale = double(width) / image._width;
+    double offset = (height - image._height*scale) / 2;
+    auto source = [](double position, unsigned size, unsigned& first,
+                     double& fraction) {
+        position = max(0.0, min(double(size - 1), position));
+        first = min(unsigned(position), size > 1 ? size - 2 : 0);
+        fraction = size > 1 ? position - first : 0;
+    };
+    vector<unsigned char> line(3*width);
+    for(unsigned y=0; y<height; y++) {
+        unsigned y0;
+        double fy;
+        source((y + 0.5 - offset)/scale - 0.5, image._height, y0, fy);
+        unsigned y1 = min(y0 + 1, image._height - 1);
+        for(unsigned x=0; x<width; x++) {
+            unsigned x0;
+            double fx;
+            source((x + 0.5)/scale - 0.5, image._width, x0, fx);
+            unsigned x1 = min(x0 + 1, image._width - 1);
+            for(int c=0; c<3; c++) {
+                double upper = image(y0, x0)[c]*(1 - fx) +
+                    image(y0, x1)[c]*fx;
+                double lower = image(y1, x0)[c]*(1 - fx) +
+                    image(y1, x1)[c]*fx;
+                line[3*x + c] =
+                    (unsigned char)lround(upper*(1 - fy) + lower*fy);
+            }
+        }
+        if (!fwrite(line.data(), line.size(), 1, stdout)) {
+            cerr << "failed to write the frame\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+// SolveBoard's search, as an object that can be run a slice at a time.
+//
+// SolveBoard runs its search to the end, and the async API (see
+// Unblock-async.h) must pause it every few thousand states - but it is
+// the same search: the blocks that can't move or needn't are left out
+// (see BlockAnalysis), the budget is enforced, and past the memory cap
+// the BFS hands over to IDA*. So both drive a BoardSearch: run() goes
+// on with the BFS for a slice of states, and in between the caller
+// sees to its own business - snapshots and SIGTERM for SolveBoard,
+// cancellation and deadlines for the async solves.
+
+#ifndef UNBLOCK_SEARCH_H
+#define UNBLOCK_SEARCH_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Unblock-engine.h"
+#include "Unblock-checkpoint.h"
+#include "Unblock-pdb.h"
+
+class BoardSearch {
+public:
+    enum Status {
+        RUNNING,        // paused after a slice, with more to search
+        SOLVED,         // plan() leads to a goal
+        UNSOLVABLE,     // no board that can be reached is a goal
+        OUT_OF_BUDGET,  // plan() leads to the best board examined
+        CAPPED,         // past the memory cap - fallBack() takes over
+        STOPPED         // fallBack() was told to stop
+    };
+    // Checked every 1024 boards by fallBack; IDA* gives up if it
+    // returns true
+    typedef std::function<bool()> Stop;
+
+    // Searches 'initial' - a board of 'whole' - within 'budget'
+    BoardSearch(const Puzzle& whole, State initial,
+                const SolveBudget& budget = SolveBudget()):
+        _analysis(whole, initial), _initial(initial), _budget(budget),
+        _begin(std::chrono::steady_clock::now()), _level(1), _position(0),
+        _expanded(0), _bestBlockers(SIZE), _depth(0), _stored(0),
+        _idaBytes(0), _fellBack(false), _patternBlocks(0),
+        _examined(0)
+    {
+        _puzzle = reducePuzzle(whole, initial, _analysis, _start, _kept);
+        // We need to store the state that got us to each state - that
+        // way we can backtrack from a final board state to the starting
+        // one. This map is also our 'visited' set: we must not revisit
+        // board states we have already examined.
+        _previous[_start] = _start;
+        _frontier.assign(1, _start);
+        _best = _start;
+    }
+
+    // Breadth First Search, one level at a time: the states at the
+    // current depth, and the ones we discover from them. Returns
+    // RUNNING after 'slice' states (0: no limit), and at the end of each
+    // level - and carries on from there when called again.
+    Status run(size_t slice = 0) {
+        size_t pause = slice ? _expanded + slice : SIZE_MAX;
+        if (!_frontier.empty()) {
+            for(size_t k=_position; k<_frontier.size(); k++) {
+                _position = k;
+                if (_budget._capBytes && !(_expanded & 1023) &&
+                        projectedBytes(k) >= _budget._capBytes)
+                    return CAPPED;
+                if (_expanded && overBudget()) {
+                    _depth = _level-1;
+                    backtrack(_best);
+                    return OUT_OF_BUDGET;
+                }
+                if (_expanded >= pause)
+                    return RUNNING;
+                State state = _frontier[k];
+                Cells occupied = _puzzle.occupancy(state);
+                _expanded++;
+
+                // Check if this board state is a winning state:
+                // can the prisoner escape to his right?
+                int blockers = _puzzle.exitBlockers(state, occupied);
+                if (!blockers) {
+                    // Yes, he can escape - we did it!
+                    _depth = _level-1;
+                    backtrack(state);
+                    return SOLVED;
+                }
+                if (blockers < _bestBlockers) {
+                    _best = state;
+                    _bestBlockers = blockers;
+                }
+
+                // Nope, the prisoner is still trapped.
+                //
+                // Add all the states arrising from immediate possible
+                // moves that we haven't seen before to the next level.
+                // (A Bloom filter in front of the map doesn't pay: only
+                // one lookup in ten is of a new state - the one it can
+                // tell - and that one still has to go into the map.)
+                _puzzle.forEachMove(state, occupied,
+                    [&](State n, int, int) {
+                        if (_previous.insert(std::make_pair(n, state)).second)
+                            _next.push_back(n);
+                    });
+            }
+            _frontier.swap(_next);
+            _next.clear();
+            _position = 0;
+            _level++;
+            return RUNNING;
+        }
+        _depth = _level-2;
+        _plan.clear();
+        return UNSOLVABLE;
+    }
+
+    // After CAPPED: the map and the levels are freed, and IDA* searches
+    // from the start - using half the cap for a transposition table, and
+    // the other half for the biggest pattern database that fits in it
+    // (see Unblock-pdb.h). No board the BFS examined is a goal, so its
+    // bound starts past them. The plan it finds is optimal all the same
+    // - but it can take far longer to find. It runs until the budget
+    // runs out or 'stop' says so - or, given a 'slice', for that many
+    // states (give or take a thousand): it then returns RUNNING, and the
+    // next call goes on from there.
+    //
+    // An unsolvable board is told by the database, if its estimate of
+    // the start is -1 - or else by IDA*, if the table holds all the
+    // boards it can reach (see IDAStar). Past that, only the budget (or
+    // 'stop') ends the search.
+    Status fallBack(Stop stop = Stop(), size_t slice = 0) {
+        bool first = !_fellBack;
+        if (first) {
+            _fellBack = true;
+            // (In case we run out of budget after all)
+            backtrack(_best);
+            _depth = _level-1;
+            _stored = _previous.size();
+            std::unordered_map<State, State>().swap(_previous);
+            std::vector<State>().swap(_frontier);
+            std::vector<State>().swap(_next);
+
+            // (The more blocks in the pattern, the bigger the table -
+            // mostly: a crowded lane has fewer placements, so a bigger
+            // pattern can fit where a smaller one didn't.)
+            size_t tried = 0;
+            for(int k=1; k<=_puzzle._count; k++) {
+                std::vector<int> pattern =
+                    PatternDatabase::choosePattern(_puzzle, _start, k);
+                if (pattern.size() == tried)
+                    break;
+                tried = pattern.size();
+                std::unique_ptr<PatternDatabase> bigger(new PatternDatabase);
+                if (bigger->build(_puzzle, _start, pattern,
+                                  _budget._capBytes/2))
+                    _pdb.swap(bigger);
+            }
+            _patternBlocks = _pdb ? _pdb->blocks() : 0;
+            if (_pdb && _pdb->estimate(_start) < 0) {
+                _idaBytes = _pdb->bytes();
+                _plan.clear();
+                return UNSOLVABLE;
+            }
+            auto estimate = [this](State s) {
+                int h = _pdb ? _pdb->estimate(s) : 0;
+                return h < 0 ? -1 : std::max(h, exitLaneBlocks(_puzzle, s));
+            };
+            _ida.reset(new IDAStar(_puzzle, true, estimate));
+            _ida->useTable(_budget._capBytes/2);
+            _idaBytes = _ida->tableBytes() + (_pdb ? _pdb->bytes() : 0);
+            _examined = _expanded;
+        }
+
+        size_t pause = _expanded + slice;
+        bool told = false, paused = false;
+        _ida->stopWhen([&](size_t n) {
+            _expanded = _examined + n;
+            if (stop && stop())
+                return told = true;
+            if ((_budget._states && _expanded >= _budget._states) ||
+                (_budget._seconds && seconds() >= _budget._seconds))
+                return true;
+            return paused = slice && _expanded >= pause;
+        });
+        std::vector<State> path;
+        int moves = first ? _ida->solve(_start, &path, _depth) :
+            _ida->resume(&path);
+        _expanded = _examined + _ida->expanded();
+        if (_ida->stopped())
+            return told ? STOPPED : paused ? RUNNING : OUT_OF_BUDGET;
+        if (moves < 0) {
+            _plan.clear();
+            return UNSOLVABLE;
+        }
+        _depth = moves;
+        _plan.swap(path);
+        return SOLVED;
+    }
+
+    // The boards of the plan found - boards of the whole puzzle, from
+    // the starting one on. (See Status for what the plan leads to.)
+    std::vector<State> plan() const {
+        std::vector<State> boards;
+        for(size_t k=0; k<_plan.size(); k++)
+            boards.push_back(expandState(_initial, _plan[k], _kept));
+        return boards;
+    }
+
+    // The puzzle searched: the whole one, minus the blocks left out
+    const Puzzle& puzzle() const { return _puzzle; }
+    const BlockAnalysis& analysis() const { return _analysis; }
+    // The level being searched (the starting board is on level 1)
+    int level() const { return _level; }
+    size_t expanded() const { return _expanded; }
+    bool fellBack() const { return _fellBack; }
+    // The blocks of fallBack's pattern database (0 if none fit)
+    int patternBlocks() const { return _patternBlocks; }
+    double seconds() const {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - _begin).count();
+    }
+
+    // What the map and the levels take: each node of the map holds a
+    // pair and a link - and the allocator adds about as much again.
+    size_t bytes() const {
+        return _previous.size()*(sizeof(std::pair<State, State>) +
+                                 2*sizeof(void*))
+            + _previous.bucket_count()*sizeof(void*)
+            + (_frontier.capacity() + _next.capacity())*sizeof(State)
+            + _idaBytes;
+    }
+
+    // How far the search went - as of the last run() or fallBack()
+    void stats(SolveStats& stats, Status status) const {
+        stats._expanded = _expanded;
+        stats._stored = _fellBack ? _stored : _previous.size();
+        stats._bytes = bytes();
+        stats._depth = _depth;
+        stats._seconds = seconds();
+        stats._outOfBudget = status == OUT_OF_BUDGET;
+        stats._fellBack = _fellBack;
+    }
+
+    // Saves the BFS to 'path' (see Unblock-checkpoint.h), with the
+    // '_engine' and '_board' of 'header' as given
+    bool save(const std::string& path, SnapshotHeader header,
+              std::string& error) const {
+        header._level = _level;
+        header._position = _position;
+        header._expanded = _expanded;
+        header._best = _best;
+        header._bestBlockers = _bestBlockers;
+        header._seconds = seconds();
+        return saveSnapshot(path, header, _frontier, _next, _previous,
+                            error);
+    }
+
+    // Carries on from the BFS saved in 'path' instead
+    bool restore(const std::string& path, SnapshotHeader& header,
+                 std::string& error) {
+        std::vector<State> frontier, next;
+        std::unordered_map<State, State> previous;
+        if (!loadSnapshot(path, header, frontier, next, previous, error))
+            return false;
+        _frontier.swap(frontier);
+        _next.swap(next);
+        _previous.swap(previous);
+        _level = header._level;
+        _position = header._position;
+        _expanded = header._expanded;
+        _best = header._best;
+        _bestBlockers = header._bestBlockers;
+        _begin -= std::chrono::duration_cast<
+            std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(header._seconds));
+        return true;
+    }
+
+private:
+    BoardSearch(const BoardSearch&);
+    BoardSearch& operator=(const BoardSearch&);
+
+    // The plan from the start to 'state', walking the map backwards
+    void backtrack(State state) {
+        _plan.clear();
+        for(State s=state; ; s=_previous[s]) {
+            _plan.push_back(s);
+            if (s == _start)
+                break;
+        }
+        std::reverse(_plan.begin(), _plan.end());
+    }
+
+    // The clock isn't free - so time and memory are only checked
+    // every 1024 states
+    bool overBudget() const {
+        if (_budget._states && _expanded >= _budget._states)
+            return true;
+        if (_expanded & 1023)
+            return false;
+        return (_budget._bytes && bytes() >= _budget._bytes) ||
+            (_budget._seconds && seconds() >= _budget._seconds);
+    }
+
+    // What the search will take by the end of the level being searched,
+    // if the rest of it adds states at the rate it did so far: for each
+    // state, a node of the map, a bucket, and a place in the next level
+    size_t projectedBytes(size_t k) const {
+        size_t more = _next.size()*(_frontier.size() - k)/
+            std::max<size_t>(k, 1);
+        return bytes() + more*(sizeof(std::pair<State, State>) +
+            3*sizeof(void*) + sizeof(State));
+    }
+
+    BlockAnalysis _analysis;
+    Puzzle _puzzle;
+    State _initial, _start;
+    std::vector<int> _kept;
+    SolveBudget _budget;
+    std::chrono::steady_clock::time_point _begin;
+
+    std::unordered_map<State, State> _previous;
+    std::vector<State> _frontier, _next;
+    int _level;
+    size_t _position, _expanded;
+    // The boards closest to an escape so far, in case we give up
+    State _best;
+    int _bestBlockers;
+
+    std::vector<State> _plan;
+    int _depth;
+    // What the BFS stored before fallBack freed it, and what IDA* took
+    size_t _stored, _idaBytes;
+    bool _fellBack;
+    int _patternBlocks;
+    // fallBack's search, and the states the BFS examined before it
+    std::unique_ptr<PatternDatabase> _pdb;
+    std::unique_ptr<IDAStar> _ida;
+    size_t _examined;
+};
+
+#endif
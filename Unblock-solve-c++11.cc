@@ -1,19 +1,48 @@
 #include <assert.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
+#include <chrono>
 #include <algorithm>
-#include <fstream>
-#include <map>
-#include <set>
+#include <sstream>
 #include <list>
-#include <tuple>
+#include <unordered_map>
+
+#include "Unblock-engine.h"
+#include "Unblock-checkpoint.h"
+#include "Unblock-frame.h"
+#include "Unblock-locate.h"
+#include "Unblock-png.h"
+#include "Unblock-perf.h"
+#include "Unblock-patch.h"
+#include "Unblock-pdb.h"
+#include "Unblock-search.h"
 
 using namespace std;
 
-// RGB data of the image
-static unsigned char g_image[480][320][3];
+// Whether to report progress (off when benchmarking or streaming)
+static bool g_verbose = true;
+
+// The limits of each solve (-t, -n, -m); none by default
+static SolveBudget g_budget;
+
+// The cost of moves for the weighted searches (-w); one per tile moved
+static MoveCost g_cost;
+
+// Where SolveBoard saves snapshots of its searches (-c, -i, -r); nowhere
+// by default
+static SolveCheckpoint g_checkpoint;
+
+// Set by SIGTERM (with -c): SolveBoard saves a snapshot, and we exit
+static volatile sig_atomic_t g_terminate = 0;
+
+void onTerminate(int)
+{
+    g_terminate = 1;
+}
 
 // The board is SIZE x SIZE tiles
 #define SIZE 6
@@ -51,94 +80,113 @@ struct Block {
         _id(BlockId++), _y(y), _x(x), _isHorizontal(isHorizontal),
         _kind(kind), _length(length)
         {}
-    // Since _id, _y and _x fit in 8 bits,
-    // a Block hash can be easily obtained via plain shifts:
-    unsigned hash() { return _id | (_y << 8) | (_x << 16); }
 };
 int Block::BlockId = 0;
 
 // This function (called at startup) scans the g_tiles and g_borders
 // arrays, and understands where the blocks are.
 //
-// Returns a list of the detected Blocks
-list<Block> ScanBodiesAndBordersAndEmitStartingBlockPositions()
+// It is a single sweep over the tiles, row by row: each block is met
+// first at its top-left tile - a tile with a white top border - and
+// from there we follow it to its end, claiming its tiles. So by the
+// time we reach any other tile of a block, it is already claimed.
+//
+// Returns a list of the detected Blocks. Whatever doesn't add up to a
+// board (tiles belonging to no block, blocks of impossible lengths,
+// no prisoner...) is described in 'problems'.
+list<Block> ScanBodiesAndBordersAndEmitStartingBlockPositions(
+    vector<string>& problems)
 {
     list<Block> blocks;
-    bool isTileKnown[SIZE][SIZE];
+    bool isClaimed[SIZE][SIZE];
+    memset(isClaimed, false, sizeof(isClaimed));
+    problems.clear();
+    auto complain = [&](int y, int x, const char *what) {
+        ostringstream out;
+        out << "tile " << y << "," << x << ": " << what;
+        problems.push_back(out.str());
+    };
+    auto emit = [&](int y, int x, bool isHorizontal, int length) {
+        TileKind kind = g_tiles[y][x];
+        const char *marker = kind == prisoner ? " (marker)" : "";
+        if (g_verbose) {
+            cout << (isHorizontal ? "Horizontal" : "Vertical  ");
+            cout << " block at " << y << "," << x;
+            cout << " of length " << length << marker << "\n";
+        }
+        for(int i=1; i<length; i++)
+            if ((isHorizontal ? g_tiles[y][x+i] : g_tiles[y+i][x]) != kind)
+                complain(y, x, "block is part prisoner, part not");
+        blocks.push_back(Block(y, x, isHorizontal, kind, length));
+    };
 
-    // Initially, we don't have a clue what each tile has
-    memset(isTileKnown, false, sizeof(isTileKnown));
-    while (true) {
-        for(int y=0; y<SIZE; y++) {
-            for(int x=0; x<SIZE; x++) {
-                if (isTileKnown[y][x])
-                    // Skip over tiles we already know
-                    continue;
-
-                if (empty == g_tiles[y][x]) {
-                    // Skip over empty tiles
-                    isTileKnown[y][x] = true;
-                    continue;
+    for(int y=0; y<SIZE; y++) {
+        for(int x=0; x<SIZE; x++) {
+            // Skip over empty tiles, and those of blocks we already met
+            if (empty == g_tiles[y][x] || isClaimed[y][x])
+                continue;
+            isClaimed[y][x] = true;
+
+            // Use the border information:
+            if (g_borders[2*y][x] == white &&
+                    g_borders[2*y+1][x] == black) {
+                // If a tile has white on top and black on bottom,
+                // then it is part of a horizontal block.
+                // Scan horizontally to find its end
+                int xend = x+1;
+                while(xend<SIZE && empty != g_tiles[y][xend] &&
+                        g_borders[2*y][xend] == white &&
+                        g_borders[2*y+1][xend] == black)
+                    isClaimed[y][xend++] = true;
+                // Adjacent horizontal blocks look like one long run...
+                switch (xend-x) {
+                case 1:
+                    complain(y, x, "horizontal block of length 1");
+                    break;
+                case 2:
+                case 3:
+                    emit(y, x, true, xend-x);
+                    break;
+                case 4:
+                    // ...which for a run of 4 can only be two blocks
+                    // of length 2...
+                    emit(y, x, true, 2);
+                    emit(y, x+2, true, 2);
+                    break;
+                default:
+                    // ...but for 5 or 6, there's more than one way
+                    complain(y, x, "can't tell where the horizontal "
+                             "blocks in this run start and end");
                 }
-                bool isMarker = (g_tiles[y][x]==prisoner);
-                const char *marker = isMarker?" (marker)":"";
-
-                // Use the border information:
-                if (g_borders[2*y][x] == white &&
-                        g_borders[2*y+1][x] == black) {
-                    // If a tile has white on top and black on bottom,
-                    // then it is part of a horizontal block
-                    isTileKnown[y][x] = true;
-                    int xend = x+1;
-                    // Scan horizontally to find its end
-                    while(xend<SIZE && g_borders[2*y+1][xend] == black &&
-                            g_borders[2*y][xend] == white) {
-                        isTileKnown[y][xend] = true;
-                        xend++;
-                    }
-                    // two adjacent blocks of length 2 would lead
-                    // to a 'block' of length 4...
-                    if (xend-x==4) {
-                        // ...in that case, emit two blocks of length 2
-                        cout << "Horizontal blocks at " << y << "," << x;
-                        cout << " of length 2 " << marker << "\n";
-                        blocks.push_back(
-                            Block(y,x, true, g_tiles[y][x], 2));
-                        blocks.push_back(
-                            Block(y,x+2, true, g_tiles[y][x+2], 2));
-                    } else {
-                        // ... otherwise emit only one block
-                        cout << "Horizontal block at " << y << "," << x;
-                        cout << " of length " << xend-x << marker << "\n";
-                        blocks.push_back(
-                            Block(y,x, true, g_tiles[y][x], xend-x));
-                    }
-                } else if (g_borders[2*y][x] == white) {
-                    // If a tile has white on top, but no black
-                    // on bottom, then it is part of a vertical block.
-                    isTileKnown[y][x] = true;
-                    int yend = y+1;
-                    // Scan vertically to find its end
-                    while(yend<SIZE && g_borders[2*yend+1][x] != black) {
-                        isTileKnown[yend][x] = true;
-                        yend++;
-                    }
-                    cout << "Vertical   block at " << y << "," << x;
-                    cout << " of length " << yend-y+1 << marker << "\n";
-                    blocks.push_back(
-                        Block(y,x, false, g_tiles[y][x], yend-y+1));
-                } else
-                    // either an empty, or a body-of-block tile
-                    isTileKnown[y][x] = true;
-            }
+            } else if (g_borders[2*y][x] == white) {
+                // If a tile has white on top, but no black
+                // on bottom, then it is part of a vertical block.
+                // Scan vertically to find its end (a black bottom)
+                int yend = y+1;
+                while(yend<SIZE && empty != g_tiles[yend][x] &&
+                        !isClaimed[yend][x] &&
+                        g_borders[2*yend+1][x] != black)
+                    isClaimed[yend++][x] = true;
+                if (yend==SIZE || empty == g_tiles[yend][x] ||
+                        isClaimed[yend][x])
+                    complain(y, x, "vertical block with no bottom");
+                else {
+                    isClaimed[yend][x] = true;
+                    if (yend-y+1 > 3)
+                        complain(y, x, "vertical block longer than 3");
+                    else
+                        emit(y, x, false, yend-y+1);
+                }
+            } else
+                // The body of a block, without the block's start
+                complain(y, x, "tile belongs to no block");
         }
-        bool allDone = true;
-        for(int y=0; y<SIZE; y++)
-            for(int x=0; x<SIZE; x++)
-                allDone = allDone && isTileKnown[y][x];
-        if (allDone)
-            break;
     }
+    int prisoners = count_if(blocks.begin(), blocks.end(),
+        [](const Block& b) { return b._kind == prisoner; });
+    if (prisoners != 1)
+        problems.push_back(prisoners ?
+            "more than one prisoner" : "no prisoner");
     return blocks;
 }
 
@@ -184,370 +232,993 @@ void printBoard(const list<Block>& blocks)
     cout << "\b+------------------+\n";
 }
 
-// A board is indeed represented as a list of Blocks.
-// However, when we move Blocks around, we need to be able
-// to detect if a tile is empty or not - so a 2D representation
-// (for quick tile access) is required.
-struct Board {
-    TileKind _data[SIZE*SIZE];
-
-    // UPDATE, Jan 26, 2013:
-    // Connor Duggan correctly reported that just using tile state
-    // is not enough to represent a board - what if we have a different
-    // arrangement of vertical and horizontal blocks that cover
-    // the same tiles?  e.g.
-    //
-    //             AA AA          AA BB
-    //             BB BB    vs    AA BB
-    //
-    // if we just compare tile data, the two boards will seem identical
-    // when we check the 'visited' set in the main loop - but they aren't!
-    //
-    // We therefore store a hash per block, formed by combining the
-    // block index, and the block coordinates (simple shifts, since
-    // all 3 numbers easily fit in 8 bits - see Block::hash() above)
-    //
-    // How much space to reserve for these hashes? Since blocks are
-    // at least 2-tile sized:
-    unsigned _hashes[SIZE*SIZE/2];
-
-    // 2D access operator
-    // i.e. instead of 'arr[y][x]' you do 'arr(y,x)'
-    inline TileKind& operator()(int y, int x) {
-        return _data[y*SIZE+x];
-    }
-    // This type is also used in both sets and maps as a key -
-    // so it needs a comparison operator. Using the block
-    // _hashes instead of the tile _data, we avoid misidentifying
-    // a board state as identical when different block arrangements
-    // end up covering the same tiles.
-    bool operator<(const Board& r) const {
-        return memcmp(_hashes, r._hashes, sizeof(_hashes)) < 0;
-    }
-    // Initial state: set all tiles to empty
-    Board() {
-        memset(&_data, empty, sizeof(_data));
-        memset(&_hashes, 0, sizeof(_hashes));
-    }
-};
+// The search itself (see SolveBoard) doesn't move Blocks around: the
+// attributes of the blocks that never change - orientation, length,
+// lane - are kept once, as arrays in a Puzzle, and a board state is just
+// the coordinate of each block along its lane, packed in a 64-bit State
+// (see Unblock-engine.h). These functions convert between the two.
 
-// This function takes a list of blocks, and 'renders' them
-// into a Board - for quick tile access. It also stores
-// the block hashes into the Board.
-Board renderBlocks(list<Block>& blocks)
+// The Puzzle and State for a list of Blocks,
+// with block i of the Puzzle being the i-th of the list
+void puzzleFromBlocks(const list<Block>& blocks, Puzzle& puzzle,
+                      State& state)
 {
-    unsigned idx=0;
-    Board tmp;
-    for(auto& p: blocks) {
-        if (p._isHorizontal)
-            for(int i=0; i<p._length; i++)
-                tmp(p._y, p._x+i) = p._kind;
-        else
-            for(int i=0; i<p._length; i++)
-                tmp(p._y+i, p._x) = p._kind;
-        assert(idx < SIZE*SIZE/2);
-        tmp._hashes[idx++] = p.hash();
-    }
-    return tmp;
+    puzzle = Puzzle();
+    state = 0;
+    for(auto& b: blocks)
+        puzzle.addBlock(b._y, b._x, b._isHorizontal, b._length,
+                        b._kind == prisoner, state);
 }
 
-// When we find the solution, we also need to backtrack
-// to display the moves we used to get there...
-//
-// "Move" stores what block moved and to what direction
-struct Move {
-    int _blockId;
-    int _distance;
-    enum Direction {left, right, up, down} _move;
-    Move(int blockID, Direction d, int steps):
-        _blockId(blockID),
-        _distance(steps),
-        _move(d) {}
-};
+// The blocks given to puzzleFromBlocks, moved to where 'state' has them
+list<Block> moveBlocks(const list<Block>& blocks, State state)
+{
+    list<Block> moved(blocks);
+    int i = 0;
+    for(auto& b: moved)
+        (b._isHorizontal ? b._x : b._y) = Puzzle::get(state, i++);
+    return moved;
+}
 
-// Utility function - we need to be able to "deep copy"
-// a list of Blocks, to form alternate board states (see SolveBoard)
-list<Block> copyBlocks(const list<Block>& blocks)
+// A list of Blocks for a packed state - block i gets id i
+list<Block> blocksFromState(const Puzzle& puzzle, State state)
 {
-    list<Block> copied;
-    for(auto& block : blocks) copied.push_back(block);
-    return copied;
+    list<Block> blocks;
+    Block::BlockId = 0;
+    for(int i=0; i<puzzle._count; i++)
+        blocks.push_back(Block(puzzle.y(state, i), puzzle.x(state, i),
+            puzzle._isHorizontal[i],
+            i == puzzle._prisoner ? prisoner : block,
+            puzzle._length[i]));
+    return blocks;
 }
 
 // The brains of the operation - basically a Breadth-First-Search
 // of the problem space:
 //    http://en.wikipedia.org/wiki/Breadth-first_search
+// (The search itself is a BoardSearch - see Unblock-search.h.)
+//
+// Returns true if a solution was found - in which case 'solution' holds
+// the boards from the starting one to the one where the prisoner can
+// escape. 'expanded' is set to the number of board states examined.
+//
+// If the search runs out of 'budget' first, it returns false, and
+// 'solution' holds the best-known plan instead: the shortest way to the
+// examined board with the fewest tiles left in the prisoner's way.
+// Either way, 'stats' (if given) tells how far the search went.
 //
-void SolveBoard(list<Block>& blocks)
+// With a 'checkpoint', the search saves a snapshot of itself every so
+// often, and when it runs out of budget; on SIGTERM (see onTerminate)
+// it saves one and exits. It can resume from the snapshot of an earlier
+// run (see Unblock-checkpoint.h) - if that was a search of the same
+// board. The snapshot of another board is left alone, for when its turn
+// comes - unless this search has to save one of its own first (there is
+// room for a single search in the file).
+//
+bool SolveBoard(list<Block>& blocks, list<list<Block> >& solution,
+                size_t& expanded, const SolveBudget& budget = SolveBudget(),
+                SolveStats *stats = NULL, SolveCheckpoint *checkpoint = NULL)
 {
-    cout << "\nSearching for a solution...\n";
-
-    // We need to store the last move that got us to a specific
-    // board state - that way we can backtrack from a final board
-    // state to the list of moves we used to achieve it.
-    typedef pair<Board, int> BoardAndLevel;
-    map<BoardAndLevel, Move> previousMoves;
-    // Start by storing a "sentinel" value, for the initial board
-    // state - we used no Move to achieve it, so store a block id
-    // of -1 to mark it:
-    int oldLevel = 0;
-    BoardAndLevel key(renderBlocks(blocks), oldLevel);
-    previousMoves.insert(
-        pair<BoardAndLevel, Move>(key, Move(-1, Move::left, 1)));
-
-    // We must not revisit board states we have already examined,
-    // so we need a 'visited' set:
-    set<Board> visited;
-
-    // Now, to implement Breadth First Search, all we need is a Queue
-    // storing the states we need to investigate - so it needs to
-    // be a list of board states... We'll also be maintaining
-    // the depth we traversed to reach this board state, and the
-    // move to perform - so we end up with a tuple of
-    // int (depth), Move, list of blocks (state).
-    typedef tuple<int, Move, list<Block> > DepthAndMoveAndState;
-    list<DepthAndMoveAndState> queue;
-
-    // Start with our initial board state, and playedMoveDepth set to 1
-    queue.push_back(DepthAndMoveAndState(
-        1, Move(-1, Move::left, 0 ), blocks));
-    cout << "Depth searched:   " << oldLevel;
-
-    while(!queue.empty()) {
-
-        // Extract first element of the queue
-        auto qtop = *queue.begin();
-        auto level = get<0>(qtop);
-        auto move = get<1>(qtop);
-        auto blocks = get<2>(qtop);
-        queue.pop_front();
-
-        // Report depth increase when it happens
-        if (level > oldLevel) {
-            cout << "\b\b\b"; cout.width(3); cout << level; cout.flush();
-            oldLevel = level;
-        }
+    // A stop asked for in between searches
+    if (g_terminate)
+        exit(128 + SIGTERM);
+    if (g_verbose)
+        cout << "\nSearching for a solution...\n";
 
-        // Create a Board for fast 2D access to tile state
-        Board board = renderBlocks(blocks);
+    // What we search over are packed States: a few bits per block -
+    // its coordinate along its lane. (Since a State says where *each*
+    // block is, two different arrangements of blocks covering the same
+    // tiles are different states - as Connor Duggan reported, comparing
+    // tiles alone would mix them up.)
+    Puzzle whole;
+    State initial;
+    puzzleFromBlocks(blocks, whole, initial);
 
-        // Have we seen this board before?
-        if (visited.find(board) != visited.end())
-            // Yep - skip it
-            continue;
+    // Blocks that can't move, or never need to, are left out of the
+    // search: they become part of the walls (see BlockAnalysis).
+    BoardSearch search(whole, initial, budget);
+    if (g_verbose) {
+        int immobile = 0;
+        for(int i=0; i<whole._count; i++)
+            immobile += search.analysis()._immobile[i];
+        cout << "Blocks: " << whole._count << ", " << immobile;
+        cout << " can't move, ";
+        cout << whole._count - immobile - search.puzzle()._count;
+        cout << " needn't.\n";
+    }
 
-        // No, we haven't - store it so we avoid re-doing
-        // the following work again in the future...
-        visited.insert(board);
-
-        /* Store board and move, so we can backtrack later */ \
-        BoardAndLevel key(board, oldLevel);
-        previousMoves.insert(pair<BoardAndLevel, Move>(key, move));
-
-        // Check if this board state is a winning state:
-        // Find prisoner block...
-        auto it=find_if(blocks.begin(), blocks.end(),
-            [](Block& x) { return x._kind == prisoner; });
-        assert(it != blocks.end()); // The prisoner is always there!
-
-        // Can he escape? Check to his right!
-        bool allClear = true;
-        for (int x=it->_x+it->_length; x<SIZE ; x++) {
-            allClear = allClear && !board(it->_y, x);
-            if (!allClear)
-                break;
+    // Carry on from where a snapshot left off, if there's one. Only its
+    // header is read, until we know it is a snapshot of this search.
+    static const char engineName[8] = "blocks";
+    bool checkpointing = checkpoint && !checkpoint->_path.empty();
+    string board = formatBoard(whole, initial);
+    if (checkpointing && checkpoint->_resume &&
+            access(checkpoint->_path.c_str(), F_OK) == 0) {
+        SnapshotHeader header;
+        string error;
+        bool readable = peekSnapshot(checkpoint->_path, header, error);
+        bool sameSearch = readable &&
+            !memcmp(header._engine, engineName, 8) &&
+            !board.compare(0, SIZE*SIZE, header._board, SIZE*SIZE);
+        if (sameSearch)
+            readable = search.restore(checkpoint->_path, header, error);
+        if (!readable) {
+            cerr << error << " - searching from scratch\n";
+            checkpoint->_resume = false;
+        } else if (sameSearch) {
+            checkpoint->_resume = false;
+            if (g_verbose) {
+                cout << "Resuming at depth " << search.level()-1;
+                cout << ", with " << search.expanded();
+                cout << " states examined already.\n";
+            }
         }
-        if (allClear) {
-            // Yes, he can escape - we did it!
-            cout << "\n\nSolved!\n";
+    } else if (checkpointing)
+        checkpoint->_resume = false;
+    if (g_verbose)
+        cout << "Depth searched:   " << search.level()-1;
 
-            // To print the Moves we used in normal order, we will
-            // backtrack through the board states to print
-            // the Move we used at each one...
-            list<list<Block> > solution;
-            solution.push_front(copyBlocks(blocks));
+    auto lastSnapshot = chrono::steady_clock::now();
+    auto snapshot = [&]() {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header._engine, engineName, 8);
+        memcpy(header._board, board.data(), SIZE*SIZE);
+        string error;
+        if (!search.save(checkpoint->_path, header, error))
+            cerr << error << "\n";
+        else
+            checkpoint->_resume = false;  // any other snapshot is gone
+        lastSnapshot = chrono::steady_clock::now();
+    };
 
-            auto itMove = previousMoves.find(
-                BoardAndLevel(board, level));
-            while (itMove != previousMoves.end()) {
-                if (itMove->second._blockId == -1)
-                    // Sentinel - reached starting board
-                    break;
-                // Find the block we moved, and move it
-                // (in reverse direction - we are going back)
-                auto it = find_if(blocks.begin(), blocks.end(),
-                    [itMove](Block& block) {
-                        return block._id == itMove->second._blockId;
-                    });
-                assert(it != blocks.end());
-
-                switch(itMove->second._move) {
-                case Move::left:
-                    it->_x+=itMove->second._distance; break;
-                case Move::right:
-                    it->_x-=itMove->second._distance; break;
-                case Move::up:
-                    it->_y+=itMove->second._distance; break;
-                case Move::down:
-                    it->_y-=itMove->second._distance; break;
+    // The search runs 1024 states at a time; in between, we report the
+    // depth, and see to snapshots and SIGTERM.
+    BoardSearch::Status status;
+    int shown = 0;
+    while (true) {
+        if (g_verbose && search.level() != shown) {
+            shown = search.level();
+            cout << "\b\b\b"; cout.width(3); cout << shown;
+            cout.flush();
+        }
+        if (g_terminate) {
+            if (checkpointing) {
+                snapshot();
+                if (g_verbose) {
+                    cout << "\n\nStopped - the search is saved in ";
+                    cout << checkpoint->_path << ".\n";
                 }
-
-                // Add this board to the front of the list...
-                solution.push_front(copyBlocks(blocks));
-                board = renderBlocks(blocks);
-                level--;
-                itMove = previousMoves.find(BoardAndLevel(board, level));
-            }
-            // Now that we have the full list, emit it in order
-            for(auto& blocks: solution) {
-                printBoard(blocks);
-                cout << "Press ENTER for next move\n";
-                cin.get();
             }
-            cout << "Run free, prisoner, run! :-)\n";
-            exit(0);
+            exit(128 + SIGTERM);
+        }
+        if (checkpointing && chrono::duration<double>(
+                chrono::steady_clock::now() - lastSnapshot).count() >=
+                    checkpoint->_seconds)
+            snapshot();
+        status = search.run(1024);
+        if (status != BoardSearch::RUNNING)
+            break;
+    }
+    // Past the memory cap (-M), it goes on with IDA* (see fallBack)
+    if (status == BoardSearch::CAPPED) {
+        if (g_verbose) {
+            cout << "\n\nMemory cap reached - going on with IDA*...\n";
+            cout.flush();
+        }
+        status = search.fallBack([]() { return g_terminate != 0; });
+        if (status == BoardSearch::STOPPED)
+            exit(128 + SIGTERM);
+        if (g_verbose && search.patternBlocks()) {
+            cout << "(with a pattern database of ";
+            cout << search.patternBlocks() << " blocks)\n";
         }
+    } else if (status == BoardSearch::OUT_OF_BUDGET && checkpointing)
+        snapshot();  // (A bigger budget can resume from here)
 
-        // Nope, the prisoner is still trapped.
-        //
-        // Add all potential states arrising from immediate
-        // possible moves to the end of the queue.
-        for(auto& block: blocks) {
-
-#define COMMON_BODY(direction) \
-    auto copiedBlocks = copyBlocks(blocks);                 \
-    auto candidateBoard = renderBlocks(copiedBlocks);       \
-    if (visited.find(candidateBoard) == visited.end()) {    \
-        /* Add to the end of the queue for further study */ \
-        queue.push_back(                                    \
-            DepthAndMoveAndState(                           \
-                level+1,                                    \
-                Move(block._id, Move::direction, distance), \
-                copiedBlocks));                             \
+    if (g_verbose && status == BoardSearch::SOLVED)
+        cout << (search.fellBack() ? "\n" : "\n\n") << "Solved!\n";
+    if (g_verbose && status == BoardSearch::OUT_OF_BUDGET)
+        cout << (search.fellBack() ? "\n" : "\n\n") << "Out of budget!\n";
+    // A search that's over leaves nothing to resume - but the snapshot
+    // of another board, still waiting for its turn, stays
+    if (checkpointing && !checkpoint->_resume &&
+            status != BoardSearch::OUT_OF_BUDGET)
+        unlink(checkpoint->_path.c_str());
+
+    solution.clear();
+    for(auto s: search.plan())
+        solution.push_back(moveBlocks(blocks, s));
+    expanded = search.expanded();
+    if (stats)
+        search.stats(*stats, status);
+    return status == BoardSearch::SOLVED;
+}
+
+// How far a search went, e.g. before running out of budget
+string describeStats(const SolveStats& stats)
+{
+    ostringstream out;
+    out << stats._expanded << " states examined (" << stats._stored;
+    out << " seen, " << (stats._bytes + 1023)/1024 << " KB) to depth ";
+    out << stats._depth << " in " << stats._seconds << " s";
+    if (stats._fellBack)
+        out << ", the last of them by IDA*";
+    return out.str();
+}
+
+// Shows the solution found by SolveBoard, one move at a time
+void PlaySolution(list<list<Block> >& solution)
+{
+    for(auto& blocks: solution) {
+        printBoard(blocks);
+        cout << "Press ENTER for next move\n";
+        cin.get();
     }
+    cout << "Run free, prisoner, run! :-)\n";
+}
 
-            if (block._isHorizontal) {
-                // Can the block move to the left?
-                int blockStartingX = block._x;
-                for(int distance=1; distance<SIZE; distance++) {
-                    int testX = blockStartingX-distance;
-                    if (testX>=0 && empty==board(block._y, testX)) {
-                        block._x = testX;
-                        COMMON_BODY(left)
-                    } else
-                        break;
-                }
-                // Can the block move to the right?
-                for(int distance=1; distance<SIZE; distance++) {
-                    int testX = blockStartingX+distance-1+block._length;
-                    if (testX<SIZE && empty==board(block._y, testX)) {
-                        block._x = blockStartingX+distance;
-                        COMMON_BODY(right)
-                    } else
-                        break;
-                }
-                block._x = blockStartingX;
-            } else {
-                // Can the block move up?
-                int blockStartingY = block._y;
-                for(int distance=1; distance<SIZE; distance++) {
-                    int testY = blockStartingY-distance;
-                    if (testY>=0 && empty==board(testY, block._x)) {
-                        block._y = testY;
-                        COMMON_BODY(up)
-                    } else
-                        break;
-                }
-                // Can the block move down?
-                for(int distance=1; distance<SIZE; distance++) {
-                    int testY = blockStartingY+distance-1+block._length;
-                    if (testY<SIZE && empty==board(testY, block._x)) {
-                        block._y = blockStartingY+distance;
-                        COMMON_BODY(down)
-                    } else
-                        break;
-                }
-                block._y = blockStartingY;
-            }
+// The detection heuristics, as lookup tables: each channel's value
+// maps to a few flag bits (one per threshold), and the flags of all
+// three channels map to the verdict. Built once, from the thresholds.
+struct ColorTables {
+    unsigned char _bodyFlags[3][256];    // per channel: 1: b>15, 2: g<30
+    TileKind _body[4];
+    unsigned char _borderFlags[3][256];  // 1: r>200, 2: r<40,
+    BorderKind _border[16];              // 4: g>160, 8: g<30
+
+    ColorTables() {
+        memset(_bodyFlags, 0, sizeof(_bodyFlags));
+        memset(_borderFlags, 0, sizeof(_borderFlags));
+        // (The red channel, surprisingly, was not necessary for bodies.
+        // The blocks have no blue at all, and the wood between them
+        // from 24 to 33 - a single pixel was fine with "over 30", but
+        // the average of a patch of wood can be lower than that.)
+        for(int v=0; v<256; v++) {
+            _bodyFlags[2][v] = v > 15 ? 1 : 0;
+            _bodyFlags[1][v] = v < 30 ? 2 : 0;
+            _borderFlags[0][v] = v > 200 ? 1 : v < 40 ? 2 : 0;
+            _borderFlags[1][v] = v > 160 ? 4 : v < 30 ? 8 : 0;
         }
-        // and go recheck the queue, from the top!
+        for(int f=0; f<4; f++)
+            _body[f] = (f & 1) ? empty : (f & 2) ? prisoner : block;
+        for(int f=0; f<16; f++)
+            _border[f] = (f & 5) == 5 ? white :
+                         (f & 10) == 10 ? black : notBorder;
     }
-}
 
-void DetectTileBodies()
+    TileKind body(const unsigned char *rgb) const {
+        return _body[_bodyFlags[0][rgb[0]] | _bodyFlags[1][rgb[1]] |
+                     _bodyFlags[2][rgb[2]]];
+    }
+    BorderKind border(const unsigned char *rgb) const {
+        return _border[_borderFlags[0][rgb[0]] | _borderFlags[1][rgb[1]] |
+                       _borderFlags[2][rgb[2]]];
+    }
+};
+static const ColorTables g_colors;
+
+// How many lines the patches at the tile centers span
+#define BODY_PATCH_LINES 3
+
+void DetectTileBodies(const ImageView& image, const BoardGeometry& geometry)
 {
-    // This function looks at the center pixel of each tile,
-    // and guesses what TileKind it is.
+    // This function looks at the center of each tile (a small patch
+    // around the center pixel - see Unblock-patch.h), and guesses
+    // what TileKind it is.
     //
     // (Heuristics on the snapshots taken from my iPhone)
     //
-    cout << "Detecting tile bodies...\n";
+    if (g_verbose)
+        cout << "Detecting tile bodies...\n";
+    unsigned lines[SIZE*SIZE], columns[SIZE*SIZE];
     for(int y=0; y<SIZE; y++) {
         for(int x=0; x<SIZE; x++) {
-            unsigned line   = 145 + y*50;
-            unsigned column =  34 + x*50;
-            // The red channel, surprisingly, was not necessary
-            //unsigned char r = g_image[line][column][0];
-            unsigned char g = g_image[line][column][1];
-            unsigned char b = g_image[line][column][2];
-            if (b > 30)
-                g_tiles[y][x] = empty;
-            else if (g < 30)
-                g_tiles[y][x] = prisoner;
-            else
-                g_tiles[y][x] = block;
+            lines[y*SIZE+x]   = geometry.line(y);
+            columns[y*SIZE+x] = geometry.column(x);
         }
     }
+    unsigned char colors[SIZE*SIZE][3];
+    AveragePatches(image, lines, columns, SIZE*SIZE, BODY_PATCH_LINES,
+                   colors);
+    for(int y=0; y<SIZE; y++)
+        for(int x=0; x<SIZE; x++)
+            g_tiles[y][x] = g_colors.body(colors[y*SIZE+x]);
+}
+
+// The frame lines sampled by DetectTileBodies and
+// DetectTopAndBottomTileBorders - the only ones we need to decode.
+vector<unsigned> SampledLines(const BoardGeometry& geometry)
+{
+    vector<unsigned> lines;
+    for(int y=0; y<SIZE; y++) {
+        unsigned line = geometry.line(y);
+        lines.push_back(geometry.topBorder(y));
+        for(unsigned i=0; i<BODY_PATCH_LINES; i++)
+            lines.push_back(line - BODY_PATCH_LINES/2 + i);
+        lines.push_back(geometry.bottomBorder(y));
+    }
+    return lines;
+}
+
+// ...and the columns (the patches reach a bit to each side of these)
+vector<unsigned> SampledColumns(const BoardGeometry& geometry)
+{
+    vector<unsigned> columns;
+    for(int x=0; x<SIZE; x++) {
+        columns.push_back(geometry.column(x) - PATCH_RADIUS);
+        columns.push_back(geometry.column(x) + PATCH_RADIUS);
+    }
+    return columns;
 }
 
-void DetectTopAndBottomTileBorders()
+void DetectTopAndBottomTileBorders(const ImageView& image,
+                                   const BoardGeometry& geometry)
 {
-    cout << "Detecting top and bottom tile borders...\n\n";
+    if (g_verbose)
+        cout << "Detecting top and bottom tile borders...\n\n";
+    // Row 2*y of g_borders is the top border of tile row y, and
+    // row 2*y+1 its bottom one
+    unsigned lines[2*SIZE*SIZE], columns[2*SIZE*SIZE];
     for(int y=0; y<SIZE; y++) {
         for(int x=0; x<SIZE; x++) {
-            unsigned line    = 145 + y*50;
-            unsigned column  =  34 + x*50;
-            unsigned ytop    = line - 23;
-            unsigned ybottom = line + 23;
-
-            unsigned char r = g_image[ytop][column][0];
-            unsigned char g = g_image[ytop][column][1];
-            //unsigned char b = g_image[ytop][column][2];
-            if      (r > 200 && g > 160) g_borders[y*2][x] = white;
-            else if (r < 40 && g < 30)   g_borders[y*2][x] = black;
-            else                         g_borders[y*2][x] = notBorder;
-
-            r = g_image[ybottom][column][0];
-            g = g_image[ybottom][column][1];
-            //b = g_image[ybottom][column][2];
-            if      (r > 200 && g > 160) g_borders[y*2+1][x] = white;
-            else if (r < 40 && g < 30)   g_borders[y*2+1][x] = black;
-            else                         g_borders[y*2+1][x] = notBorder;
+            lines[2*y*SIZE + x]     = geometry.topBorder(y);
+            lines[(2*y+1)*SIZE + x] = geometry.bottomBorder(y);
+            columns[2*y*SIZE + x] = columns[(2*y+1)*SIZE + x] =
+                geometry.column(x);
         }
     }
+    unsigned char colors[2*SIZE*SIZE][3];
+    AveragePatches(image, lines, columns, 2*SIZE*SIZE, 1, colors);
+    for(int y=0; y<2*SIZE; y++)
+        for(int x=0; x<SIZE; x++)
+            g_borders[y][x] = g_colors.border(colors[y*SIZE+x]);
+}
+
+// The State of 'blocks' in an existing Puzzle - for the board of a new
+// frame, where the blocks may be listed in another order (the scan
+// lists them by their top-left tile). 'previous' is the board before.
+//
+// Returns false if these are not the blocks of the puzzle.
+bool stateOfBlocks(const Puzzle& puzzle, State previous,
+                   const list<Block>& blocks, State& state)
+{
+    if (int(blocks.size()) != puzzle._count)
+        return false;
+    state = 0;
+    for(int i=0; i<puzzle._count; i++) {
+        auto isLike = [&](bool isHorizontal, int length, int lane,
+                          bool isPrisoner) {
+            return isHorizontal == puzzle._isHorizontal[i] &&
+                length == puzzle._length[i] && lane == puzzle._lane[i] &&
+                isPrisoner == (i == puzzle._prisoner);
+        };
+        // Blocks of the same length on the same lane can't pass each
+        // other - so they keep their order along it.
+        int rank = 0, same = 0;
+        for(int j=0; j<puzzle._count; j++)
+            if (isLike(puzzle._isHorizontal[j], puzzle._length[j],
+                       puzzle._lane[j], j == puzzle._prisoner)) {
+                same++;
+                rank += Puzzle::get(previous, j) < Puzzle::get(previous, i);
+            }
+        vector<int> coordinates;
+        for(auto& b: blocks)
+            if (isLike(b._isHorizontal, b._length,
+                       b._isHorizontal ? b._y : b._x, b._kind == prisoner))
+                coordinates.push_back(b._isHorizontal ? b._x : b._y);
+        if (int(coordinates.size()) != same)
+            return false;
+        sort(coordinates.begin(), coordinates.end());
+        state = Puzzle::set(state, i, coordinates[rank]);
+    }
+    return puzzle.isLegal(state);
+}
+
+// The searches the benchmark can run (-e). Each returns the optimal
+// number of moves (or -1 if there's no solution), and sets 'expanded'
+// to the number of states it examined.
+struct Engine {
+    const char *_name;
+    int (*_solve)(const Puzzle& puzzle, State start, size_t *expanded);
+    const char *_description;
+};
+
+int solveWithBlocks(const Puzzle& puzzle, State start, size_t *expanded)
+{
+    list<Block> blocks = blocksFromState(puzzle, start);
+    list<list<Block> > solution;
+    return SolveBoard(blocks, solution, *expanded, g_budget, NULL,
+                      &g_checkpoint) ?
+        int(solution.size())-1 : -1;
 }
 
-int main()
+int solveWithLayers(const Puzzle& puzzle, State start, size_t *expanded)
 {
-    ifstream rgbDataFileStream;
-    rgbDataFileStream.open("data.rgb", ios::in | ios::binary);
-    if (!rgbDataFileStream.is_open()) {
-        cerr << "Convert your iPhone snapshot to 'data.rgb' ";
-        cerr << "with ImageMagick:\n\n";
-        cerr << "\tbash$ convert IMG_0354.PNG data.rgb\n\n";
+    vector<State> path;
+    return SolvePathRanked(puzzle, start, path, expanded) ?
+        int(path.size())-1 : -1;
+}
+
+int solveWithSortedLevels(const Puzzle& puzzle, State start,
+                          size_t *expanded)
+{
+    vector<State> path;
+    return SolveSorted(puzzle, start, path, expanded) ?
+        int(path.size())-1 : -1;
+}
+
+int solveWithPackedLevels(const Puzzle& puzzle, State start,
+                          size_t *expanded)
+{
+    vector<State> path;
+    return SolveLevels<PackedLevel>(puzzle, start, path, expanded) ?
+        int(path.size())-1 : -1;
+}
+
+int solveWithTiles(const Puzzle& puzzle, State start, size_t *expanded)
+{
+    return SolveWeighted(puzzle, start, g_cost, NULL, expanded);
+}
+
+// The transposition table is what tells unsolvable boards (see IDAStar)
+int solveWithIDA(const Puzzle& puzzle, State start, size_t *expanded)
+{
+    return SolveIDA(puzzle, start, true, NULL, expanded,
+                    IDAStar::Estimate(), 16 << 20);
+}
+
+// The pattern database is built for each board - and its time is part
+// of the solve's.
+int solveWithAStar(const Puzzle& puzzle, State start, size_t *expanded)
+{
+    PatternDatabase pdb;
+    pdb.build(puzzle, start, PatternDatabase::choosePattern(puzzle, start, 8));
+    return SolveAStar(puzzle, start, [&](State s) {
+        int h = pdb.estimate(s);
+        return h < 0 ? -1 : max(h, exitLaneBlocks(puzzle, s));
+    }, NULL, expanded);
+}
+
+static const Engine g_engines[] = {
+    { "blocks", solveWithBlocks,
+      "SolveBoard, as used for the frames (the default)" },
+    { "depth", SolveDepth,
+      "BFS for the depth only, with a hashed visited set" },
+    { "bits", SolveDepthRanked,
+      "BFS for the depth only, with a bit per ranked state" },
+    { "layers", solveWithLayers,
+      "BFS keeping 2 bits of depth per ranked state, for the path" },
+    { "sorted", solveWithSortedLevels,
+      "BFS over radix-sorted levels, with no hash table" },
+    { "packed", solveWithPackedLevels,
+      "the same, with the levels delta-encoded to save memory" },
+    { "tiles", solveWithTiles,
+      "Dijkstra for the fewest tiles moved (or the -w cost)" },
+    { "ida", solveWithIDA,
+      "IDA*, trying independent moves in one order only" },
+    { "astar", solveWithAStar,
+      "A*, guided by a pattern database of 8 blocks" },
+};
+
+// Benchmark mode: reads boards from stdin (one per line, in corpus
+// format), solves each one, and reports the time and hardware counters
+// spent - both per solve, and per examined board state.
+void RunBenchmark(const Engine& engine)
+{
+    g_verbose = false;
+    PerfCounters counters;
+    if (!counters.hasHardware())
+        cerr << "No hardware counters available, using software ones.\n";
+
+    uint64_t totals[PerfCounters::EVENTS];
+    memset(totals, 0, sizeof(totals));
+    size_t totalExpanded = 0, solves = 0;
+    double totalSeconds = 0;
+
+    string line;
+    while (getline(cin, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        string board, error;
+        istringstream(line) >> board;
+        Puzzle puzzle;
+        State start;
+        if (!parseBoard(board, puzzle, start, error)) {
+            cerr << board << ": " << error << "\n";
+            continue;
+        }
+        size_t expanded = 0;
+        counters.start();
+        int moves = engine._solve(puzzle, start, &expanded);
+        counters.stop();
+
+        cout << board;
+        cout << " moves=" << moves;
+        cout << " states=" << expanded;
+        cout << " usec=" << uint64_t(counters.seconds() * 1e6);
+        for(int e=0; e<PerfCounters::EVENTS; e++) {
+            PerfCounters::Event event = PerfCounters::Event(e);
+            if (!counters.valid(event))
+                continue;
+            cout << " " << PerfCounters::name(event) << "=";
+            cout << counters.value(event) << "/";
+            cout << double(counters.value(event)) / max<size_t>(expanded, 1);
+            totals[e] += counters.value(event);
+        }
+        cout << "\n";
+        totalExpanded += expanded;
+        totalSeconds += counters.seconds();
+        solves++;
+    }
+
+    // The per-state figures of the whole run are the interesting ones
+    cout << "# solves=" << solves << " states=" << totalExpanded;
+    cout << " usec=" << uint64_t(totalSeconds * 1e6);
+    for(int e=0; e<PerfCounters::EVENTS; e++) {
+        PerfCounters::Event event = PerfCounters::Event(e);
+        if (!counters.valid(event))
+            continue;
+        cout << " " << PerfCounters::name(event) << "/state=";
+        cout << double(totals[e]) / max<size_t>(totalExpanded, 1);
+    }
+    cout << "\n";
+}
+
+// A cheap fingerprint of the pixels around the sampling points of each
+// tile (its center, and its top and bottom border samples). If none of
+// them changed since the last frame, neither did what we detect there.
+typedef uint64_t TileHashes[SIZE][SIZE];
+
+void HashTiles(const ImageView& image, const BoardGeometry& geometry,
+               TileHashes& hashes)
+{
+    // A short run of pixels on each sampled line, centered on the
+    // sampled column - at least as wide as the detectors' patches, so
+    // we also notice changes right next to them.
+    unsigned reach = max(unsigned(PATCH_RADIUS),
+                         unsigned(geometry._pitch/10));
+    for(int y=0; y<SIZE; y++) {
+        for(int x=0; x<SIZE; x++) {
+            unsigned line   = geometry.line(y);
+            unsigned column = geometry.column(x);
+            vector<unsigned> lines(1, geometry.topBorder(y));
+            for(unsigned i=0; i<BODY_PATCH_LINES; i++)
+                lines.push_back(line - BODY_PATCH_LINES/2 + i);
+            lines.push_back(geometry.bottomBorder(y));
+            uint64_t h = 14695981039346656037ULL; // FNV-1a
+            for(size_t k=0; k<lines.size(); k++)
+                for(unsigned c=column-reach; c<=column+reach; c++) {
+                    const unsigned char *pixel = image(lines[k], c);
+                    for(int i=0; i<3; i++)
+                        h = (h ^ pixel[i]) * 1099511628211ULL;
+                }
+            hashes[y][x] = h;
+        }
+    }
+}
+
+// Whether two lists of blocks (as emitted by the scan) are the same board
+bool sameBoard(const list<Block>& a, const list<Block>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for(auto i=a.begin(), j=b.begin(); i!=a.end(); ++i, ++j)
+        if (i->_y != j->_y || i->_x != j->_x ||
+                i->_isHorizontal != j->_isHorizontal ||
+                i->_kind != j->_kind || i->_length != j->_length)
+            return false;
+    return true;
+}
+
+// Describes the move from one board of a solution to the next: the
+// block's letter (as shown by printBoard), direction and distance.
+string describeMove(const list<Block>& from, const list<Block>& to)
+{
+    ostringstream out;
+    for(auto i=from.begin(), j=to.begin(); i!=from.end(); ++i, ++j) {
+        if (i->_y == j->_y && i->_x == j->_x)
+            continue;
+        out << (i->_kind == prisoner ?
+                'Z' : "ABCDEFGHIJKLMNOPQRSTUVWXYZ"[i->_id]) << " ";
+        if (j->_x < i->_x)      out << "left "  << i->_x - j->_x;
+        else if (j->_x > i->_x) out << "right " << j->_x - i->_x;
+        else if (j->_y < i->_y) out << "up "    << i->_y - j->_y;
+        else                    out << "down "  << j->_y - i->_y;
+        break;
+    }
+    return out.str();
+}
+
+// The moves left in a plan, and the next one
+string describePlan(const Puzzle& puzzle, const vector<State>& plan)
+{
+    ostringstream out;
+    out << plan.size()-1 << " moves";
+    if (plan.size() > 1)
+        out << ", next: " << describeMove(blocksFromState(puzzle, plan[0]),
+                                          blocksFromState(puzzle, plan[1]));
+    return out.str();
+}
+
+// Stream mode: reads one raw frame after the other (e.g. from a camera
+// pipe), and prints a line per frame with the solution for the board
+// in it - how many moves remain, and which one to do next.
+//
+// Detecting and solving on every frame would be a waste: the board
+// rarely changes between two frames. So we first compare the tile
+// fingerprints with those of the previous frame - and only if a tile
+// changed, we run the detectors; and only if they see a different
+// board, we solve again. Otherwise, the previous solution still holds.
+//
+// And when the board did change, it is usually because the player
+// moved a block. If it was the move we suggested, we just advance
+// along the plan; if it was another slide, we re-plan from the new
+// board with the Planner - which knows the distance of every board on
+// the old plan, and so rarely has to search as deep as SolveBoard.
+void RunStream(const string& path, unsigned width, unsigned height,
+               bool locate)
+{
+    g_verbose = false;
+    FrameStream stream;
+    string error;
+    if (!stream.open(path, width, height, error)) {
+        cerr << error << "\n";
         exit(1);
     }
-    rgbDataFileStream.read(
-        reinterpret_cast<char*>(&g_image[0][0][0]),
-        480*320*3);
-    if (rgbDataFileStream.fail() || rgbDataFileStream.eof()) {
-        cerr << "Failed to read 480x320x3 bytes from 'data.rgb'...\n\n";
+    const ImageView& image = stream.view();
+    // The camera doesn't move, so the board is located only once
+    BoardGeometry geometry;
+    bool located = !locate && width == FRAME_WIDTH && height == FRAME_HEIGHT;
+
+    TileHashes hashes, previousHashes;
+    bool haveHashes = false;
+    list<Block> board;
+    string status = "no board";
+    // The plan for the current board: plan[0] is the board itself
+    Puzzle puzzle;
+    vector<State> plan, replanned;
+    Planner planner;
+    size_t frames = 0, detections = 0, solves = 0, replans = 0;
+    auto start = chrono::steady_clock::now();
+    for(; stream.next(); frames++) {
+        cout << "frame " << frames << ": ";
+        if (!located) {
+            if (!LocateBoard(image, geometry)) {
+                cout << "no board\n";
+                cout.flush();
+                continue;
+            }
+            located = true;
+        }
+        HashTiles(image, geometry, hashes);
+        if (haveHashes && !memcmp(hashes, previousHashes, sizeof(hashes))) {
+            cout << "unchanged, " << status << "\n";
+            cout.flush();
+            continue;
+        }
+        memcpy(previousHashes, hashes, sizeof(hashes));
+        haveHashes = true;
+        detections++;
+        DetectTileBodies(image, geometry);
+        DetectTopAndBottomTileBorders(image, geometry);
+        Block::BlockId = 0;
+        vector<string> problems;
+        list<Block> blocks =
+            ScanBodiesAndBordersAndEmitStartingBlockPositions(problems);
+        if (detections > 1 && sameBoard(blocks, board)) {
+            cout << "same board, " << status << "\n";
+            cout.flush();
+            continue;
+        }
+        board = blocks;
+
+        bool isSlide = false;
+        State state;
+        if (problems.empty() && !plan.empty() &&
+                stateOfBlocks(puzzle, plan[0], blocks, state))
+            puzzle.forEachMove(plan[0], [&](State n, int, int) {
+                isSlide = isSlide || n == state;
+            });
+        if (!problems.empty()) {
+            // (a hand over the board, say)
+            cout << "new board";
+            status = "no board (" + problems[0] + ")";
+            plan.clear();
+        } else if (isSlide && plan.size() > 1 && state == plan[1]) {
+            cout << "moved as planned";
+            plan.erase(plan.begin());
+            status = describePlan(puzzle, plan);
+        } else if (isSlide) {
+            cout << "moved off plan";
+            replans++;
+            if (!planner.replan(puzzle, state, plan, int(plan.size())-2,
+                                replanned)) {
+                status = "no solution";
+                plan.clear();
+            } else {
+                plan.swap(replanned);
+                status = describePlan(puzzle, plan);
+            }
+        } else {
+            cout << "new board";
+            solves++;
+            list<list<Block> > solution;
+            size_t expanded;
+            SolveStats stats;
+            plan.clear();
+            if (!SolveBoard(blocks, solution, expanded, g_budget, &stats))
+                status = stats._outOfBudget ?
+                    "no solution within budget (" + describeStats(stats) + ")"
+                    : "no solution";
+            else {
+                // The boards of the solution list their blocks
+                // in the same order as 'blocks'
+                puzzleFromBlocks(blocks, puzzle, state);
+                for(auto& step: solution) {
+                    State s = 0;
+                    int i = 0;
+                    for(auto& b: step)
+                        s = Puzzle::set(s, i++, b._isHorizontal ? b._x : b._y);
+                    plan.push_back(s);
+                }
+                status = describePlan(puzzle, plan);
+            }
+        }
+        cout << ", " << status << "\n";
+        cout.flush();
+    }
+
+    double seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+    cerr << "# frames=" << frames << " detections=" << detections;
+    cerr << " solves=" << solves << " replans=" << replans;
+    cerr << " usec/frame=" << uint64_t(seconds * 1e6 / max<size_t>(frames, 1));
+    cerr << "\n";
+}
+
+void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " [options] [frame ...]\n\n";
+    cerr << "Solves the boards in frames: PNG snapshots, or raw RGB\n";
+    cerr << "data ('-' for stdin; by default, 'data.rgb').\n\n";
+    cerr << "  -B   benchmark: solve the boards in stdin (corpus format)\n";
+    cerr << "       and report time and hardware counters per solve\n";
+    cerr << "  -e engine  the search to benchmark:\n";
+    for(auto& engine: g_engines) {
+        cerr << "       " << engine._name;
+        cerr << string(8 - strlen(engine._name), ' ');
+        cerr << engine._description << "\n";
+    }
+    cerr << "  -s   sparse: only read the sampled pixels of raw frames\n";
+    cerr << "       (for frames on network-backed or cold storage)\n";
+    cerr << "  -g WxH  the size of raw frames (default: 320x480)\n";
+    cerr << "  -l   locate the board even in 320x480 frames (in other\n";
+    cerr << "       sizes, it is always located)\n";
+    cerr << "  -S   stream: read raw frames back to back from the (single)\n";
+    cerr << "       frame given, and print the next move for each one\n";
+    cerr << "  -w S:T     find the cheapest plan instead of the shortest:\n";
+    cerr << "             each slide costs S, plus T per tile moved\n";
+    cerr << "             (e.g. 0:1 for the fewest tiles moved)\n";
+    cerr << "  -t msec    give up on boards not solved in this time\n";
+    cerr << "  -n states  ...or after examining this many board states\n";
+    cerr << "  -m MB      ...or when the search takes this much memory\n";
+    cerr << "  -M MB      when SolveBoard's BFS would take more memory\n";
+    cerr << "             than this, go on with IDA* instead\n";
+    cerr << "  -c file    save snapshots of searches in this file, to\n";
+    cerr << "             resume them after SIGTERM (not with -S, nor\n";
+    cerr << "             with -B and engines other than 'blocks')\n";
+    cerr << "  -i sec     the time between snapshots (default: 60)\n";
+    cerr << "  -r         resume the search saved in the -c file\n";
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    bool sparse = false, locate = false, streaming = false;
+    bool benchmark = false, weighted = false;
+    const Engine *engine = &g_engines[0];
+    unsigned rawWidth = FRAME_WIDTH, rawHeight = FRAME_HEIGHT;
+    int opt;
+    while ((opt = getopt(argc, argv, "Be:sg:lSw:t:n:m:M:c:i:r")) != -1) {
+        switch (opt) {
+        case 'B':
+            benchmark = true;
+            break;
+        case 'e':
+            engine = NULL;
+            for(auto& e: g_engines)
+                if (!strcmp(e._name, optarg))
+                    engine = &e;
+            if (!engine)
+                usage(argv[0]);
+            break;
+        case 's':
+            sparse = true;
+            break;
+        case 'g':
+            if (2 != sscanf(optarg, "%ux%u", &rawWidth, &rawHeight) ||
+                    !rawWidth || !rawHeight)
+                usage(argv[0]);
+            break;
+        case 'l':
+            locate = true;
+            break;
+        case 'S':
+            streaming = true;
+            break;
+        case 'w':
+            if (2 != sscanf(optarg, "%d:%d", &g_cost._slide, &g_cost._tile)
+                    || g_cost._slide < 0 || g_cost._tile < 0 ||
+                    g_cost._slide + g_cost._tile == 0)
+                usage(argv[0]);
+            weighted = true;
+            break;
+        case 't':
+            g_budget._seconds = atof(optarg)/1000;
+            break;
+        case 'n':
+            g_budget._states = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            g_budget._bytes = size_t(atof(optarg)*1024*1024);
+            break;
+        case 'M':
+            g_budget._capBytes = size_t(atof(optarg)*1024*1024);
+            break;
+        case 'c':
+            g_checkpoint._path = optarg;
+            break;
+        case 'i':
+            g_checkpoint._seconds = atof(optarg);
+            if (g_checkpoint._seconds <= 0)
+                usage(argv[0]);
+            break;
+        case 'r':
+            g_checkpoint._resume = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // Only SolveBoard saves snapshots
+    if (!g_checkpoint._path.empty()) {
+        if (streaming || (benchmark && engine != &g_engines[0]))
+            usage(argv[0]);
+        signal(SIGTERM, onTerminate);
+    } else if (g_checkpoint._resume)
+        usage(argv[0]);
+
+    if (benchmark) {
+        RunBenchmark(*engine);
+        return 0;
+    }
+
+    vector<string> frames(argv+optind, argv+argc);
+    if (streaming) {
+        if (frames.size() > 1)
+            usage(argv[0]);
+        RunStream(frames.empty() ? "-" : frames[0], rawWidth, rawHeight,
+                  locate);
+        return 0;
+    }
+    if (frames.empty())
+        frames.push_back("data.rgb");
+
+    // The snapshots we were written for need no locating - and then
+    // the sampled lines and columns are known before reading the frames
+    const BoardGeometry reference;
+    auto isReference = [&](unsigned width, unsigned height) {
+        return !locate && width == FRAME_WIDTH && height == FRAME_HEIGHT;
+    };
+    if (sparse && !isReference(rawWidth, rawHeight)) {
+        cerr << "Sparse reads need 320x480 frames, with no locating.\n";
         exit(1);
     }
-    rgbDataFileStream.close();
-    DetectTileBodies();
-    DetectTopAndBottomTileBorders();
-    list<Block> blocks =
-        ScanBodiesAndBordersAndEmitStartingBlockPositions();
-    SolveBoard(blocks);
+
+    // The pixel offsets of sparse reads are the same for all frames
+    SparseFrame sparseFrame(FRAME_WIDTH, FRAME_HEIGHT,
+                            SampledLines(reference),
+                            SampledColumns(reference));
+
+    int result = 0;
+    for(auto& path: frames) {
+        FrameFile frame;
+        PngFrame png;
+        const ImageView *image = &frame.view();
+        string error;
+        string extension = path.size() > 4 ? path.substr(path.size()-4) : "";
+        transform(extension.begin(), extension.end(), extension.begin(),
+                  ::tolower);
+        if (extension == ".png") {
+            // Decode in-process - only the lines we are going to sample,
+            // if we know them; all of them, if the board must be located.
+            auto linesFor = [&](unsigned width, unsigned height) {
+                return isReference(width, height) ?
+                    SampledLines(reference) : vector<unsigned>();
+            };
+            if (!png.open(path, linesFor, error)) {
+                cerr << error << "\n";
+                exit(1);
+            }
+            image = &png.view();
+        } else if (sparse && path != "-") {
+            if (!sparseFrame.open(path, error)) {
+                cerr << error << "\n";
+                exit(1);
+            }
+            image = &sparseFrame.view();
+        } else if (!frame.open(path, rawWidth, rawHeight, error)) {
+            cerr << error << "\n\n";
+            cerr << "Pass your iPhone snapshot (PNG) directly, or convert\n";
+            cerr << "it to 'data.rgb' with ImageMagick:\n\n";
+            cerr << "\tbash$ convert IMG_0354.PNG data.rgb\n\n";
+            exit(1);
+        }
+        BoardGeometry geometry;
+        if (!isReference(image->_width, image->_height)) {
+            if (!LocateBoard(*image, geometry)) {
+                cerr << path << ": cannot find the board\n";
+                result = 1;
+                continue;
+            }
+            if (g_verbose) {
+                cout << "Board located at " << geometry._top << ",";
+                cout << geometry._left << ", tiles of ";
+                cout << geometry._pitch << " pixels\n";
+            }
+        }
+        DetectTileBodies(*image, geometry);
+        DetectTopAndBottomTileBorders(*image, geometry);
+        Block::BlockId = 0;
+        vector<string> problems;
+        list<Block> blocks =
+            ScanBodiesAndBordersAndEmitStartingBlockPositions(problems);
+        if (!problems.empty()) {
+            cerr << path << ": this doesn't look like a valid board:\n";
+            for(auto& problem: problems)
+                cerr << "  " << problem << "\n";
+            result = 1;
+            continue;
+        }
+        list<list<Block> > solution;
+        size_t expanded;
+        SolveStats stats;
+        if (weighted) {
+            Puzzle puzzle;
+            State state;
+            puzzleFromBlocks(blocks, puzzle, state);
+            vector<State> path;
+            int cost = SolveWeighted(puzzle, state, g_cost, &path);
+            if (cost < 0) {
+                cout << "\n\nNo solution exists for this board!\n";
+                result = 1;
+                continue;
+            }
+            cout << "\nCheapest plan: " << path.size()-1 << " moves, ";
+            cout << "costing " << cost << "\n";
+            for(auto s: path)
+                solution.push_back(moveBlocks(blocks, s));
+            PlaySolution(solution);
+            continue;
+        }
+        if (!SolveBoard(blocks, solution, expanded, g_budget, &stats,
+                        &g_checkpoint)) {
+            if (!stats._outOfBudget)
+                cout << "\n\nNo solution exists for this board!\n";
+            else {
+                cout << "No solution within the budget: ";
+                cout << describeStats(stats) << "\n";
+                if (solution.size() > 1) {
+                    cout << "Best-known plan, towards a clearer exit:\n";
+                    PlaySolution(solution);
+                }
+            }
+            result = 1;
+            continue;
+        }
+        PlaySolution(solution);
+    }
+    return result;
 }
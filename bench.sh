@@ -23,3 +23,12 @@ for lang in "${!langs[@]}" ; do
             done | $PYTHON ./stats.py | grep Overall
     done
 done
+
+# Hardware counters (cycles, cache/TLB misses...) per solve and per
+# examined board state, over a generated corpus ("make corpus.txt")
+if [ -e corpus.txt ] ; then
+    for ENGINE in blocks depth bits layers sorted packed tiles ; do
+        echo "Benchmarking C++11 ($ENGINE search) over corpus.txt ..."
+        ./Unblock-solve-c++11 -B -e $ENGINE < corpus.txt | tail -1
+    done
+fi
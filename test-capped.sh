@@ -0,0 +1,26 @@
+#!/bin/bash
+# Checks that past the memory cap (-M), where IDA* takes over from the
+# BFS (see Unblock-search.h), the answer is still the BFS's - for boards
+# that have no solution too, which IDA* must not search forever.
+CAP=0.05
+BOARDS="
+.HHIEE...ICD.ZZ.CD..BB..GG.FFF.JJ.AA
+.CCC.A...G.A.ZZGDA..IID.BBFHHJEEF..J
+J.I.KFJCI.KFJC.ZZFBBBE.HAGGE.HA.DDD.
+A..CCGADDEJGZZBEJG.HB.F..HIIF.......
+"
+failed=0
+for board in $BOARDS ; do
+    expected=$(echo $board | ./Unblock-solve-c++11 -B -e depth 2>/dev/null |
+        awk '{print $2; exit}')
+    capped=$(echo $board | timeout 60 ./Unblock-solve-c++11 -B -M $CAP \
+        2>/dev/null | awk '{print $2; exit}')
+    if [ -n "$expected" ] && [ "$capped" = "$expected" ] ; then
+        echo "$board with -M $CAP: OK ($capped)"
+    else
+        echo "$board with -M $CAP: FAILED (${capped:-no answer}," \
+            "not $expected)"
+        failed=1
+    fi
+done
+exit $failed
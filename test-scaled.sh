@@ -0,0 +1,22 @@
+#!/bin/bash
+# Checks that the boards are found in frames of other resolutions too:
+# each snapshot is resampled (see Unblock-resample.cc) to the sizes of
+# a few phones, and must give the same board - and solution - as the
+# snapshot itself.
+SIZES="640x1136 720x1080 750x1334 1080x1920 1242x2208"
+failed=0
+for snapshot in IMG_03*.PNG ; do
+    ./Unblock-solve-c++11 $snapshot < /dev/null > expected.txt
+    for size in $SIZES ; do
+        ./Unblock-resample $snapshot $size > scaled.rgb || exit 1
+        if ./Unblock-solve-c++11 -g $size scaled.rgb < /dev/null 2>&1 | \
+                grep -v "^Board located" | cmp -s - expected.txt ; then
+            echo "$snapshot at $size: OK"
+        else
+            echo "$snapshot at $size: FAILED"
+            failed=1
+        fi
+    done
+done
+rm -f expected.txt scaled.rgb
+exit $failed